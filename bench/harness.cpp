@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <chrono>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "../src/SLVM.cpp"
+#include "../src/jit.cpp"
+
+// runs every benchmark program in a child of its own, so that the peak
+// resident set size reported by the kernel belongs to that program alone.
+//
+// the instruction count is taken from one profiled run with fusion
+// disabled, so it counts source instructions and stays comparable whether
+// or not the interpreter fuses them. the timed runs then use the program
+// the way CSLVM would run it, and the fastest of them is reported.
+// with --graphics the programs draw into a 480x360 framebuffer, like
+// CSLVM -g, and the frames per second of the fastest run are reported too.
+//
+// usage: cslvm-bench [--jit] [--graphics] [--repeat N] [--json out.json] [--baseline old.json] programs...
+
+struct BenchResult {
+	bool ok;
+	uint64_t instructions;
+	double seconds;
+	uint64_t frames;
+};
+
+struct Benchmark {
+	std::string path;
+	std::string name;
+	BenchResult result;
+	long peak_rss_kib;
+};
+
+// runs in the child
+static BenchResult measure(const std::string & path, int repeat, bool jit, bool graphics) {
+	BenchResult result = {false, 0, 0, 0};
+
+	// count
+	InstructionStorage counted;
+	if (!counted.open(path.c_str())) {
+		fprintf(stderr, "Could not open file: %s\n", path.c_str());
+		return result;
+	}
+	if (!counted.decode())
+		return result;
+	{
+		SLVM_state state;
+		if (!state.load(counted))
+			return result;
+		Profiler profiler;
+		profiler.init(counted.code_size, false);
+		state.profiler = &profiler;
+		state.run();
+		for (uint64_t n : profiler.op_counts)
+			result.instructions += n;
+	}
+
+	// time
+	InstructionStorage store;
+	store.open(path.c_str());
+	store.decode();
+	store.fuse();
+	for (int i = 0; i < repeat; i++) {
+		Renderer renderer;
+		SLVM_state state;
+		state.load(store);
+		if (graphics) {
+			renderer.init(480, 360);
+			state.renderer = &renderer;
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (graphics)
+			renderer.start(&state.graphics);
+#ifdef SLVM_JIT
+		if (jit) {
+			Jit compiler;
+			compiler.init(&state);
+			compiler.run();
+		} else
+			state.run();
+#else
+		// main turned it off already
+		(void)jit;
+		state.run();
+#endif
+		// the frames still in the ring are part of the work
+		renderer.stop();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (i == 0 || seconds < result.seconds) {
+			result.seconds = seconds;
+			result.frames = renderer.frames;
+		}
+	}
+	result.ok = true;
+	return result;
+}
+
+static bool run_benchmark(Benchmark & bench, int repeat, bool jit, bool graphics) {
+	int fds[2];
+	if (pipe(fds) != 0)
+		return false;
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+	if (pid == 0) {
+		close(fds[0]);
+		// the programs print, which is part of the work but not of the report
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		BenchResult result = measure(bench.path, repeat, jit, graphics);
+		fflush(stdout);
+		write(fds[1], &result, sizeof(result));
+		_exit(0);
+	}
+	close(fds[1]);
+	bench.result.ok = read(fds[0], &bench.result, sizeof(bench.result)) == sizeof(bench.result) && bench.result.ok;
+	close(fds[0]);
+	int status;
+	struct rusage usage;
+	if (wait4(pid, &status, 0, &usage) < 0)
+		return false;
+	bench.peak_rss_kib = usage.ru_maxrss; // kilobytes on linux
+	return bench.result.ok && WIFEXITED(status);
+}
+
+static std::string benchmark_name(const std::string & path) {
+	size_t slash = path.find_last_of('/');
+	std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+	size_t dot = name.find('.');
+	return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+static double ns_per_instruction(const Benchmark & bench) {
+	return bench.result.instructions ? bench.result.seconds * 1e9 / bench.result.instructions : 0;
+}
+
+static double frames_per_second(const Benchmark & bench) {
+	return bench.result.seconds > 0 ? bench.result.frames / bench.result.seconds : 0;
+}
+
+// one benchmark per line, so reading a baseline back needs no json parser
+static void write_json(FILE * out, std::vector<Benchmark> & benches) {
+	fprintf(out, "[\n");
+	for (size_t i = 0; i < benches.size(); i++) {
+		Benchmark & b = benches[i];
+		fprintf(
+			out,
+			"{\"name\": \"%s\", \"ok\": %s, \"instructions\": %llu, \"seconds\": %.6f, "
+			"\"instructions_per_second\": %.0f, \"ns_per_instruction\": %.3f, \"frames_per_second\": %.1f, "
+			"\"peak_rss_kib\": %ld}%s\n",
+			b.name.c_str(), b.result.ok ? "true" : "false",
+			(unsigned long long)b.result.instructions, b.result.seconds,
+			b.result.seconds > 0 ? b.result.instructions / b.result.seconds : 0.0,
+			ns_per_instruction(b), frames_per_second(b), b.peak_rss_kib,
+			i + 1 < benches.size() ? "," : ""
+		);
+	}
+	fprintf(out, "]\n");
+}
+
+// returns the ns/instruction of `name` in a file written by write_json, or 0
+static double baseline_ns(const std::string & path, const std::string & name) {
+	std::ifstream file(path.c_str());
+	std::string line;
+	std::string key = "{\"name\": \"" + name + "\"";
+	while (std::getline(file, line)) {
+		if (line.compare(0, key.size(), key) != 0)
+			continue;
+		size_t at = line.find("\"ns_per_instruction\": ");
+		if (at != std::string::npos)
+			return atof(line.c_str() + at + 22);
+	}
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	int repeat = 3;
+	bool jit = false;
+	bool graphics = false;
+	std::string json;
+	std::string baseline;
+	std::vector<Benchmark> benches;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "--repeat" || arg == "--json" || arg == "--baseline") && i + 1 == argc) {
+			printf("Value for %s not provided\n", arg.c_str());
+			return 1;
+		}
+		if (arg == "--jit")
+			jit = true;
+		else if (arg == "--graphics")
+			graphics = true;
+		else if (arg == "--repeat")
+			repeat = atoi(argv[++i]);
+		else if (arg == "--json")
+			json = argv[++i];
+		else if (arg == "--baseline")
+			baseline = argv[++i];
+		else
+			benches.push_back({arg, benchmark_name(arg), {false, 0, 0, 0}, 0});
+	}
+	if (benches.empty() || repeat < 1) {
+		printf("usage: %s [--jit] [--graphics] [--repeat N] [--json out.json] [--baseline old.json] programs...\n", argv[0]);
+		return 1;
+	}
+
+#ifndef SLVM_JIT
+	if (jit) {
+		printf("Warning: this build has no JIT, --jit is ignored\n");
+		jit = false;
+	}
+#endif
+
+	bool failed = false;
+	printf(
+		"%-12s %14s %10s %12s %10s %12s%s%s\n",
+		"benchmark", "instructions", "seconds", "Minstr/s", "ns/instr", "peak RSS",
+		graphics ? "   frames/s" : "", baseline.empty() ? "" : "     change"
+	);
+	for (Benchmark & b : benches) {
+		if (!run_benchmark(b, repeat, jit, graphics)) {
+			printf("%-12s failed\n", b.name.c_str());
+			failed = true;
+			continue;
+		}
+		printf(
+			"%-12s %14llu %10.4f %12.1f %10.2f %8.1f MiB",
+			b.name.c_str(), (unsigned long long)b.result.instructions, b.result.seconds,
+			b.result.instructions / b.result.seconds / 1e6, ns_per_instruction(b),
+			b.peak_rss_kib / 1024.0
+		);
+		if (graphics)
+			printf("  %9.1f", frames_per_second(b));
+		if (!baseline.empty()) {
+			double before = baseline_ns(baseline, b.name);
+			if (before > 0)
+				printf("  %+8.1f%%", 100.0 * (ns_per_instruction(b) - before) / before);
+			else
+				printf("  %9s", "new");
+		}
+		printf("\n");
+	}
+
+	if (!json.empty()) {
+		FILE * out = fopen(json.c_str(), "w");
+		if (!out) {
+			printf("Could not open file: %s\n", json.c_str());
+			return 1;
+		}
+		write_json(out, benches);
+		fclose(out);
+	}
+	return failed;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <chrono>
+
+#include "../src/search.cpp"
+
+// microbenchmarks of the search kernels behind contains and indexOfChar,
+// see src/search.cpp. every kernel the cpu supports searches texts of a
+// few sizes for a byte and for needles of a few lengths that only match
+// at the very end, so the whole text is scanned. the texts are made of
+// the first bytes of the needles, which is the worst case for the
+// first/last byte filter.
+//
+// usage: cslvm-search-bench [--min-bytes N]
+
+static volatile ptrdiff_t sink;
+
+// gigabytes per second of scanning `text`
+template <typename F>
+static double throughput(size_t size, double min_bytes, F search) {
+	size_t rounds = (size_t)(min_bytes / size) + 1;
+	double best = 0;
+	for (int attempt = 0; attempt < 3; attempt++) {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t r = 0; r < rounds; r++)
+			sink = search();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double rate = seconds > 0 ? rounds * (double)size / seconds / 1e9 : 0;
+		if (rate > best)
+			best = rate;
+	}
+	return best;
+}
+
+int main(int argc, char * argv[]) {
+	double min_bytes = 2e8;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--min-bytes" && i + 1 < argc)
+			min_bytes = atof(argv[++i]);
+		else {
+			printf("usage: %s [--min-bytes N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	const size_t sizes[] = {16, 64, 256, 4096, 65536, 1 << 20};
+	const size_t needle_sizes[] = {2, 8, 32};
+	printf("%-10s %9s %10s", "kernel", "bytes", "byte GB/s");
+	for (size_t m : needle_sizes)
+		printf("  needle %2zu GB/s", m);
+	printf("\n");
+	for (const StringKernels & k : STRING_KERNELS) {
+		if (!k.supported())
+			continue;
+		for (size_t size : sizes) {
+			std::string text(size, 'a');
+			text[size - 1] = 'z';
+			printf("%-10s %9zu", k.name, size);
+			printf(" %10.2f", throughput(size, min_bytes, [&] {
+				return k.find_byte(text.data(), text.size(), 'z');
+			}));
+			for (size_t m : needle_sizes) {
+				if (m > size) {
+					printf("  %14s", "-");
+					continue;
+				}
+				std::string needle(m, 'a');
+				needle[m - 1] = 'z';
+				printf("  %14.2f", throughput(size, min_bytes, [&] {
+					return k.find(text.data(), text.size(), needle.data(), needle.size());
+				}));
+			}
+			printf("\n");
+		}
+	}
+	return 0;
+}
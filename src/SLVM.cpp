@@ -1,382 +1,1000 @@
+#pragma once
+#ifdef SLVM_GLFW
 #include <GLFW/glfw3.h>
+#endif
 #include <map>
 #include <stdio.h>
 #include <string>
 #include <stack>
 #include <vector>
 #include "pre-parser.cpp"
+#include "strings.cpp"
+#include "allocator.cpp"
+#include "memory.cpp"
+#include "profile.cpp"
+#include "graphics.cpp"
+#include "search.cpp"
+#ifdef SLVM_TRACE
+#include "trace.cpp"
+#endif
 #include <queue>
 #include <math.h>
 #include <chrono>
 #include <thread>
+#include <stdint.h>
+#include <cstring>
+#include <atomic>
+#include <stdarg.h>
 
-// this allows an easy hop to data types with more capacity
-#define num_t float
-#define addr_t int
+// labels as values let run() jump straight from one handler to the next.
+// define SLVM_NO_COMPUTED_GOTO to use the portable switch instead
+#if defined(__GNUC__) && !defined(SLVM_NO_COMPUTED_GOTO)
+#define SLVM_COMPUTED_GOTO
+#endif
 
-// shortcut to get variable in front of the program pointer
-#define get_var_with_offset(n) state->get_var(code[state->instruction_pointer + n])
+// define SLVM_TRACE to build in support for --trace. without it, tracing
+// does not cost anything, not even a check
+#ifdef SLVM_TRACE
+#define TRACE_STEP() if (tracer) trace_step()
+#else
+#define TRACE_STEP()
+#endif
+
+// for the cell operations every instruction uses. in very big functions,
+// like the programs translated by --emit-cpp, the compiler stops inlining
+// them on its own
+#if defined(__GNUC__)
+#define SLVM_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define SLVM_ALWAYS_INLINE inline
+#endif
+
+// shortcut to get the address of the n-th operand of an instruction
+#define get_var_with_offset(n) state->var_addr[ins.args[n - 1]]
 // shortcuts to get value at address
 #define m_get_num(addr) state->memory[addr].get_num()
 #define m_get_str(addr) state->memory[addr].get_string()
 
-addr_t MEMORY_SIZE = 0x10000;
+const addr_t DEFAULT_MEMORY_SIZE = 0x10000;
+// how often an instruction may go back from its quickened form before it
+// stays generic, see Instructions::quicken
+const int32_t QUICKEN_LIMIT = 8;
+
+// strings that are not valid numbers read as 0
+inline num_t parse_num(const char * s) {
+	return strtof(s, NULL);
+}
+
+// numbers read as text like std::to_string writes them. this is enough
+// room for any double
+const size_t NUMBER_TEXT_SIZE = 320;
+inline std::string_view number_text(num_t n, char * scratch) {
+	int size = snprintf(scratch, NUMBER_TEXT_SIZE, "%f", (double)n);
+	return std::string_view(scratch, size < 0 ? 0 : std::min((size_t)size, NUMBER_TEXT_SIZE - 1));
+}
 
+// define SLVM_NAN_BOXING to use 8 byte memory cells instead of the
+// default 16 byte ones. both have the same interface
+#ifndef SLVM_NAN_BOXING
 struct MemoryCell {
 	union {
 		num_t n;
-		std::string * s;
+		HeapString * s;
+		const Constant * c;
 	} value;
-	bool is_num;
+	// a cell that was never written to reads as 0
+	enum : uint8_t {
+		T_UNINIT = 0,
+		T_NUM,
+		T_STR,  // holds a reference to a HeapString
+		T_CONST // refers to a constant of the program, which this cell does not own
+	} tag;
+
+	bool is_num() const {
+		return tag == T_NUM || tag == T_UNINIT;
+	}
+
+	bool is_set() const {
+		return tag != T_UNINIT;
+	}
 
-	num_t get_num() {
-		if (is_num)
+	// a computed number or a constant that is a number, see
+	// Instructions::quicken. num() may only be used on such cells
+	bool holds_num() const {
+		return tag == T_NUM || (tag == T_CONST && value.c->is_num);
+	}
+
+	num_t num() const {
+		return tag == T_NUM ? value.n : value.c->n;
+	}
+
+	SLVM_ALWAYS_INLINE num_t get_num() {
+		if (tag == T_NUM)
 			return value.n;
-		// convert string to num_t
-		// note: we can loose some accuracy
-		//       since stof returns float
-		return std::stof(*value.s);
+		if (tag == T_UNINIT)
+			return 0;
+		if (tag == T_CONST)
+			return value.c->n;
+		return parse_num(flat_string()->chars());
+	}
+
+	// flattens the rope this cell holds, if it is one, and points the cell
+	// at the flat copy instead
+	HeapString * flat_string() {
+		HeapString * s = value.s;
+		if (s->rope) {
+			s = s->flat();
+			retain(s);
+			release(value.s);
+			value.s = s;
+		}
+		return s;
 	}
 
 	std::string get_string() {
-		if (is_num)
-			return std::to_string(value.n);
-		return *value.s;
+		if (tag == T_STR)
+			return flat_string()->str();
+		if (tag == T_CONST)
+			return std::string(value.c->text);
+		return std::to_string(get_num());
+	}
+
+	// the text of the cell without copying it. a number is written into
+	// `scratch`, NUMBER_TEXT_SIZE chars that must outlive the view
+	std::string_view get_view(char * scratch) {
+		if (tag == T_STR) {
+			HeapString * s = flat_string();
+			return std::string_view(s->chars(), s->size);
+		}
+		if (tag == T_CONST)
+			return value.c->text;
+		return number_text(get_num(), scratch);
 	}
 
-	void set_num(num_t n) {
+	// the length of the text of the cell. unlike get_view, this does not
+	// flatten a rope
+	size_t get_size(char * scratch) {
+		if (tag == T_STR)
+			return value.s->size;
+		return get_view(scratch).size();
+	}
+
+	// the string this cell holds, or NULL for numbers and constants
+	HeapString * heap_string() const {
+		return tag == T_STR ? value.s : NULL;
+	}
+
+	// drops the string this cell holds, if any
+	SLVM_ALWAYS_INLINE void clear() {
+		if (tag == T_STR)
+			release(value.s);
+		tag = T_UNINIT;
+	}
+
+	SLVM_ALWAYS_INLINE void set_num(num_t n) {
+		clear();
 		value.n = n;
-		is_num = true;
+		tag = T_NUM;
+	}
+
+	// takes over the reference of the caller
+	void set_string(HeapString * s) {
+		clear();
+		value.s = s;
+		tag = T_STR;
+	}
+
+	SLVM_ALWAYS_INLINE void set_constant(const Constant * c) {
+		clear();
+		value.c = c;
+		tag = T_CONST;
 	}
 
-	void set_string(std::string s) {
-		value.s = new std::string(s);
-		is_num = false;
+	// strings are shared, not copied
+	SLVM_ALWAYS_INLINE void copy_from(const MemoryCell & other) {
+		if (other.tag == T_STR)
+			retain(other.value.s);
+		clear();
+		value = other.value;
+		tag = other.tag;
+	}
+
+	// returns a new reference to the string value of this cell
+	HeapString * to_heap_string(StringHeap & heap) {
+		if (tag == T_STR) {
+			retain(value.s);
+			return value.s;
+		}
+		return heap.create(get_string());
 	}
 
 	MemoryCell() {
-		is_num = true;
+		tag = T_UNINIT;
 		value.n = 0;
 	}
 
+	MemoryCell(const MemoryCell & other) {
+		tag = T_UNINIT;
+		copy_from(other);
+	}
+
+	MemoryCell & operator=(const MemoryCell & other) {
+		copy_from(other);
+		return *this;
+	}
+
 	~MemoryCell() {
-		if (!is_num)
-			delete value.s;
+		clear();
 	}
 };
+#else
+// numbers are stored as doubles, offset by 2^48. that moves every double,
+// including the canonical NaN, out of the range where the top 16 bits are
+// zero, which leaves that range for everything else: 0 is a cell that was
+// never written to, anything else is a pointer (user space pointers fit
+// into 48 bits). the lowest bit of the pointer tells HeapStrings, which
+// the cell holds a reference to, apart from constants of the program.
+struct MemoryCell {
+	uint64_t bits;
+
+	static constexpr uint64_t NUMBER_OFFSET = 1ull << 48;
+	static constexpr uint64_t CONSTANT_BIT = 1;
+
+	static uint64_t box(double d) {
+		if (d != d)
+			d = NAN; // other NaNs could overflow the offset
+		uint64_t b;
+		memcpy(&b, &d, sizeof(b));
+		return b + NUMBER_OFFSET;
+	}
+
+	static double unbox(uint64_t b) {
+		b -= NUMBER_OFFSET;
+		double d;
+		memcpy(&d, &b, sizeof(d));
+		return d;
+	}
+
+	HeapString * string_ptr() const {
+		return (HeapString *)(uintptr_t)bits;
+	}
+
+	const Constant * constant_ptr() const {
+		return (const Constant *)(uintptr_t)(bits & ~CONSTANT_BIT);
+	}
+
+	bool is_num() const {
+		return bits >= NUMBER_OFFSET || bits == 0;
+	}
+
+	bool is_constant() const {
+		return !is_num() && (bits & CONSTANT_BIT);
+	}
+
+	bool is_heap_string() const {
+		return !is_num() && !(bits & CONSTANT_BIT);
+	}
+
+	bool is_set() const {
+		return bits != 0;
+	}
+
+	// a computed number or a constant that is a number, see
+	// Instructions::quicken. num() may only be used on such cells
+	bool holds_num() const {
+		return bits >= NUMBER_OFFSET || (is_constant() && constant_ptr()->is_num);
+	}
+
+	num_t num() const {
+		return bits >= NUMBER_OFFSET ? unbox(bits) : constant_ptr()->n;
+	}
+
+	SLVM_ALWAYS_INLINE num_t get_num() {
+		if (bits >= NUMBER_OFFSET)
+			return unbox(bits);
+		if (bits == 0)
+			return 0;
+		if (is_constant()) {
+			const Constant * c = constant_ptr();
+			return c->n;
+		}
+		return parse_num(flat_string()->chars());
+	}
+
+	HeapString * flat_string() {
+		HeapString * s = string_ptr();
+		if (s->rope) {
+			s = s->flat();
+			retain(s);
+			release(string_ptr());
+			bits = (uint64_t)(uintptr_t)s;
+		}
+		return s;
+	}
+
+	std::string get_string() {
+		if (is_num())
+			return std::to_string(get_num());
+		if (is_constant())
+			return std::string(constant_ptr()->text);
+		return flat_string()->str();
+	}
+
+	std::string_view get_view(char * scratch) {
+		if (is_num())
+			return number_text(get_num(), scratch);
+		if (is_constant())
+			return constant_ptr()->text;
+		HeapString * s = flat_string();
+		return std::string_view(s->chars(), s->size);
+	}
+
+	size_t get_size(char * scratch) {
+		if (is_heap_string())
+			return string_ptr()->size;
+		return get_view(scratch).size();
+	}
+
+	HeapString * heap_string() const {
+		return is_heap_string() ? string_ptr() : NULL;
+	}
+
+	// drops the string this cell holds, if any
+	SLVM_ALWAYS_INLINE void clear() {
+		if (is_heap_string())
+			release(string_ptr());
+		bits = 0;
+	}
+
+	SLVM_ALWAYS_INLINE void set_num(num_t n) {
+		clear();
+		bits = box(n);
+	}
+
+	// takes over the reference of the caller
+	void set_string(HeapString * s) {
+		clear();
+		bits = (uint64_t)(uintptr_t)s;
+	}
+
+	SLVM_ALWAYS_INLINE void set_constant(const Constant * c) {
+		clear();
+		bits = (uint64_t)(uintptr_t)c | CONSTANT_BIT;
+	}
+
+	// strings are shared, not copied
+	SLVM_ALWAYS_INLINE void copy_from(const MemoryCell & other) {
+		if (other.is_heap_string())
+			retain(other.string_ptr());
+		clear();
+		bits = other.bits;
+	}
+
+	// returns a new reference to the string value of this cell
+	HeapString * to_heap_string(StringHeap & heap) {
+		if (is_heap_string()) {
+			retain(string_ptr());
+			return string_ptr();
+		}
+		return heap.create(get_string());
+	}
+
+	MemoryCell() {
+		bits = 0;
+	}
+
+	MemoryCell(const MemoryCell & other) {
+		bits = 0;
+		copy_from(other);
+	}
+
+	MemoryCell & operator=(const MemoryCell & other) {
+		copy_from(other);
+		return *this;
+	}
 
-enum GraphicInstructions{
-	GI_P_PX,
-	GI_P_LN,
-	GI_P_REC,
-	GI_P_TXT,
-	GI_GOTO,
-	GI_S_CL
+	~MemoryCell() {
+		clear();
+	}
 };
+static_assert(sizeof(MemoryCell) == 8, "NaN boxed cells should be 8 bytes");
+#endif
+
+// the return addresses of jts. a fixed array with an explicit depth rather
+// than a std::stack, so the sampling profiler can safely read it from a
+// signal handler while the program runs
+struct CallStack {
+	static constexpr addr_t CAPACITY = 1 << 20;
+
+	addr_t * frames;
+	volatile addr_t depth;
+
+	CallStack() {
+		// only the pages that are used get committed
+		frames = new addr_t[CAPACITY];
+		depth = 0;
+	}
+
+	~CallStack() {
+		delete[] frames;
+	}
+
+	CallStack(const CallStack &) = delete;
+	CallStack & operator=(const CallStack &) = delete;
+
+	// returns false if the stack is full
+	bool push(addr_t addr) {
+		if (depth == CAPACITY)
+			return false;
+		frames[depth] = addr;
+		// the frame has to be there before a signal handler can see it
+		std::atomic_signal_fence(std::memory_order_release);
+		depth = depth + 1;
+		return true;
+	}
+
+	addr_t pop() {
+		depth = depth - 1;
+		return frames[depth];
+	}
 
-struct GraphicInstruction {
-	GraphicInstructions instruction;
-	union Data {
-		struct {
-			num_t x;
-			num_t y;
-		} D_GI_P_PX;
-		struct {
-			num_t x0;
-			num_t y0;
-			num_t x1;
-			num_t y1;
-		} D_GI_P_LN;
-		struct {
-			num_t x;
-			num_t y;
-			num_t w;
-			num_t h;
-		} D_GI_P_REC;
-		struct {
-			std::string * text;
-		} D_GI_P_TXT;
-		struct {
-			num_t x;
-			num_t y;
-		} D_GI_GOTO;
-		struct {
-			num_t cl;
-		} D_GI_S_CL;
-	} data;
+	bool empty() const {
+		return depth == 0;
+	}
 };
 
+// where a state writes what the program prints and the errors it runs
+// into. without a hook, that is stdout
+typedef void (*OutputHook)(void * context, const char * text, size_t size);
+// where ask gets its answers. returns false if there is none. without a
+// hook, the question goes to the output and the answer is a line of stdin
+typedef bool (*InputHook)(void * context, std::string_view question, std::string & answer);
+
 struct SLVM_state{
-	                            MemoryCell* memory;
+	                            StringHeap  strings; // first, so it outlives every cell
+	                            MemoryCell* memory; // memory_backend.cells
+	             VirtualMemory<MemoryCell>  memory_backend;
 	                            MemoryCell  accumulator;
 	                                addr_t  instruction_pointer;
-	                    std::stack<addr_t>  call_stack;
+	                             CallStack  call_stack;
 	         std::map<std::string, addr_t>  lookup_table;
-	std::vector<std::pair<addr_t, addr_t>>  free_chunks; // <start, length>
+	                             Allocator  allocator;
 	                                  bool  running;
-	        std::queue<GraphicInstruction>  graphic_queue;
+	                                  bool  finished; // stopped by done rather than an error
+	             const InstructionStorage*  program;
+	                   DecodedInstruction*  code; // program->code, or own_code, see load()
+	       std::vector<DecodedInstruction>  own_code;
+	                               addr_t*  var_addr; // name index -> address, see load()
+	                              uint32_t  var_epoch; // bumped whenever var_addr changes
+	                                  bool  quicken; // let instructions rewrite themselves, see Instructions::quicken
+	                             Profiler*  profiler; // NULL unless profiling
+	                             Renderer*  renderer; // NULL unless drawing, see graphics.cpp
+#ifdef SLVM_TRACE
+	                               Tracer*  tracer; // NULL unless tracing
+#endif
+	                          GraphicsRing  graphics;
 	                std::stack<MemoryCell>  data_stack;
+	                            OutputHook  output; // NULL for stdout
+	                                 void*  output_context;
+	                             InputHook  input; // NULL for stdin
+	                                 void*  input_context;
+	                              uint64_t  slice_left; // see run_slice
 
-	SLVM_state() {
-		memory = new MemoryCell[MEMORY_SIZE];
-		free_chunks.push_back(std::make_pair(0, MEMORY_SIZE));
+	SLVM_state(addr_t memory_size = DEFAULT_MEMORY_SIZE) {
+		if (!memory_backend.reserve(memory_size)) {
+			printf("Error: could not reserve memory for %d cells\n", memory_size);
+			memory_size = 0;
+		}
+		memory = memory_backend.cells;
+		allocator.init(0, memory_size);
 		instruction_pointer = 0;
-		running = true;
+		running = memory != NULL;
+		finished = false;
+		program = NULL;
+		code = NULL;
+		var_addr = NULL;
+		var_epoch = 0;
+		quicken = true;
+		profiler = NULL;
+		renderer = NULL;
+#ifdef SLVM_TRACE
+		tracer = NULL;
+#endif
+		output = NULL;
+		output_context = NULL;
+		input = NULL;
+		input_context = NULL;
+		slice_left = 0;
+	}
+
+	void write_output(const char * text, size_t size) {
+		if (output)
+			output(output_context, text, size);
+		else
+			fwrite(text, 1, size, stdout);
+	}
+
+	// returns false if there is no answer, e.g. at the end of stdin
+	bool read_input(std::string_view question, std::string & answer) {
+		answer.clear();
+		if (input)
+			return input(input_context, question, answer);
+		write_output(question.data(), question.size());
+		write_output("\n", 1);
+		fflush(stdout);
+		int c;
+		while ((c = getchar()) != EOF && c != '\n')
+			answer += (char)c;
+		if (!answer.empty() && answer.back() == '\r')
+			answer.pop_back();
+		return c != EOF || !answer.empty();
+	}
+
+	// like printf, to the output of this state
+	__attribute__((format(printf, 2, 3)))
+	void report(const char * format, ...) {
+		char text[256];
+		va_list args;
+		va_start(args, format);
+		int size = vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		if (size > 0)
+			write_output(text, std::min((size_t)size, sizeof(text) - 1));
 	}
 
 	~SLVM_state() {
-		delete[] memory;
+		// the render thread reads the ring
+		if (renderer)
+			renderer->stop();
+		// the cells are not destroyed one by one: the string heap frees
+		// whatever strings they still hold when it goes away
+		memory_backend.release();
+		delete[] var_addr;
 	}
 
 	addr_t allocate_memory(addr_t size) {
-		auto it = free_chunks.begin();
-		while (it != free_chunks.end()) {
-			if (it->second == size) {
-				instruction_pointer = it->first;
-				addr_t addr = it->first;
-				free_chunks.erase(it);
-				return addr;
-			}
-			if (it->second > size) {
-				addr_t addr = it->first;
-				it->first += size;
-				it->second -= size;
-				return addr;
-			}
-			it++;
+		addr_t addr = allocator.allocate(size);
+		if (addr < 0) {
+			if (size < 1)
+				report("Error: cannot allocate %d cells\n", size);
+			else
+				report("Error: out of memory\n");
+			running = false;
+			return 0;
 		}
-		printf("Error: out of memory\n");
-		running = false;
-		return 0;
+		return addr;
 	}
 
 	void deallocate_memory(addr_t addr, addr_t size) {
-		auto it = free_chunks.begin();
-		while (it != free_chunks.end()) {
-			if (it->first < addr and it->first + it->second > addr + size) {
-				// fully contained
-				// do nothing lol
-				return;
-			}
-			if (it->first < addr and it->first + it->second > addr) {
-				// partially contained
-				it->second += it->first + it->second - addr;
-				if (it + 1 != free_chunks.end()) {
-					if (it->first + it->second <= (it + 1)->first) {
-						it->second += (it + 1)->second;
-						free_chunks.erase(it + 1);
-					}
-				}
-				return;
-			}
-			if (it->first + it->second == addr) {
-				it->first;
-				it->second += size;
-				// check if we can merge with the next free chunk
-				if (it + 1 != free_chunks.end()) {
-					if (it->first + it->second <= (it + 1)->first) {
-						it->second += (it + 1)->second;
-						free_chunks.erase(it + 1);
-					}
-				}
-				return;
-			}
-			if (it->first > addr) {
-				it = free_chunks.insert(it, { addr, size });
-				return;
-			}
-			it++;
+		if (!allocator.deallocate(addr, size)) {
+			report("Error: invalid free of %d cells at %d\n", size, addr);
+			running = false;
+			return;
 		}
+		// drop whatever the freed cells still hold
+		for (addr_t i = addr; i < addr + size; i++)
+			memory[i].clear();
+	}
 
-		std::pair<addr_t, addr_t> p = { addr, size };
-		// insert, so that the v remains sorted
-		it = free_chunks.begin();
-		while (it != free_chunks.end() and it->first < addr) {
-			it++;
-		}
-		free_chunks.insert(it, p);
-		// check if we can merge with the next free chunk
-		if (it + 1 != free_chunks.end()) {
-			if (it->first + it->second <= (it + 1)->first) {
-				it->second += (it + 1)->second;
-				free_chunks.erase(it + 1);
-			}
+	void print_stats(FILE * out) {
+		fprintf(
+			out,
+			"address space: %zu cells reserved, %zu resident\n",
+			memory_backend.size, memory_backend.resident_cells()
+		);
+		allocator.print_stats(out);
+		strings.print_stats(out);
+		if (renderer) {
+			renderer->stop();
+			renderer->print_stats(out);
 		}
 	}
 
-	void process(InstructionStorage store);
+#ifdef SLVM_TRACE
+	void trace_step() {
+		// a constant that is a number is recorded as one, like it reads
+		uint8_t kind = !accumulator.is_set() ? TV_UNINIT : accumulator.holds_num() ? TV_NUM : TV_STR;
+		tracer->record(
+			instruction_pointer,
+			code[instruction_pointer].op,
+			kind,
+			kind == TV_NUM ? accumulator.num() : 0
+		);
+	}
+#endif
+
+	void process(InstructionStorage & store);
+	void run();
+	uint64_t run_slice(uint64_t limit);
+	template <bool profile, bool sliced> void run_loop();
+
+	// binds a decoded program to this state. every variable the program
+	// names gets its address resolved here, so handlers only have to
+	// index var_addr instead of looking names up. quickening rewrites the
+	// code it runs; with `copy_code` that is a copy of its own and `store`
+	// stays as it is, so other states can run it at the same time.
+	// returns false if the program uses instructions we cannot run, or
+	// its variables do not fit into memory.
+	bool load(const InstructionStorage & store, bool copy_code = false);
+
+	// the cell of a variable, or NULL if neither the program nor get_var
+	// ever named it
+	MemoryCell * find_var(const std::string & name) {
+		auto it = lookup_table.find(name);
+		return it == lookup_table.end() ? NULL : &memory[it->second];
+	}
+
+	addr_t get_var(const std::string & name) {
+		addr_t addr = add_var(name);
+		if (addr < 0) {
+			report("Error: out of memory\n");
+			running = false;
+			return 0;
+		}
+		return addr;
+	}
 
-	addr_t get_var(std::string name) {
-		if (lookup_table.find(name) == lookup_table.end()) {
+	// like get_var, but -1 rather than an error if a new variable does not
+	// fit into memory
+	addr_t add_var(const std::string & name) {
+		auto it = lookup_table.find(name);
+		if (it == lookup_table.end()) {
 			// create new variable
-			addr_t addr = allocate_memory(1);
-			lookup_table[name] = addr;
+			addr_t addr = allocator.allocate(1);
+			if (addr < 0)
+				return -1;
+			it = lookup_table.insert({name, addr}).first;
 		}
-		return lookup_table[name];
+		return it->second;
+	}
+
+	// rebinds a variable, keeping the resolved slot of the program in sync
+	void set_var_address(int32_t name_index, addr_t addr) {
+		if (var_addr[name_index] != addr)
+			var_epoch++;
+		var_addr[name_index] = addr;
+		lookup_table[std::string(program->names[name_index])] = addr;
 	}
 };
 
+// every opcode together with its handler, in the order of the Instruction enum.
+// used to build both Instructions::func and the dispatch table of SLVM_state::run
+#define SLVM_HANDLERS(X) \
+	X(I_ldi,                           fI_ldi) \
+	X(I_loadAtVar,                     fI_loadAtVar) \
+	X(I_storeAtVar,                    fI_storeAtVar) \
+	X(I_jts,                           fI_jts) \
+	X(I_ret,                           fI_ret) \
+	X(I_addWithVar,                    fI_addWithVar) \
+	X(I_subWithVar,                    fI_subWithVar) \
+	X(I_mulWithVar,                    fI_mulWithVar) \
+	X(I_divWithVar,                    fI_divWithVar) \
+	X(I_bitwiseLsfWithVar,             fI_bitwiseLsfWithVar) \
+	X(I_bitwiseRsfWithVar,             fI_bitwiseRsfWithVar) \
+	X(I_bitwiseAndWithVar,             fI_bitwiseAndWithVar) \
+	X(I_bitwiseOrWithVar,              fI_bitwiseOrWithVar) \
+	X(I_modWithVar,                    fI_modWithVar) \
+	X(I_print,                         fI_print) \
+	X(I_println,                       fI_println) \
+	X(I_jmp,                           fI_jmp) \
+	X(I_jt,                            fI_jt) \
+	X(I_jf,                            fI_jf) \
+	X(I_boolAndWithVar,                fI_boolAndWithVar) \
+	X(I_boolOrWithVar,                 fI_boolOrWithVar) \
+	X(I_boolEqualWithVar,              fI_boolEqualWithVar) \
+	X(I_largerThanOrEqualWithVar,      fI_largerThanOrEqualWithVar) \
+	X(I_smallerThanOrEqualWithVar,     fI_smallerThanOrEqualWithVar) \
+	X(I_boolNotEqualWithVar,           fI_boolNotEqualWithVar) \
+	X(I_smallerThanWithVar,            fI_smallerThanWithVar) \
+	X(I_largerThanWithVar,             fI_largerThanWithVar) \
+	X(I_putPixel,                      fI_putPixel) \
+	X(I_putLine,                       fI_putLine) \
+	X(I_putRect,                       fI_putRect) \
+	X(I_setColor,                      fI_setColor) \
+	X(I_clg,                           fI_clg) \
+	X(I_done,                          fI_done) \
+	X(I_malloc,                        fI_malloc) \
+	X(I_round,                         fI_round) \
+	X(I_floor,                         fI_floor) \
+	X(I_ceil,                          fI_ceil) \
+	X(I_cos,                           fI_cos) \
+	X(I_sin,                           fI_sin) \
+	X(I_sqrt,                          fI_sqrt) \
+	X(I_atan2,                         fI_atan2) \
+	X(I_mouseDown,                     fI_TODO) \
+	X(I_mouseX,                        fI_TODO) \
+	X(I_mouseY,                        fI_TODO) \
+	X(I_sleep,                         fI_sleep) \
+	X(I_drawText,                      fI_drawText) \
+	X(I_loadAtVarWithOffset,           fI_loadAtVarWithOffset) \
+	X(I_storeAtVarWithOffset,          fI_storeAtVarWithOffset) \
+	X(I_isKeyPressed,                  fI_TODO) \
+	X(I_createColor,                   fI_createColor) \
+	X(I_charAt,                        fI_charAt) \
+	X(I_sizeOf,                        fI_sizeOf) \
+	X(I_contains,                      fI_contains) \
+	X(I_join,                          fI_join) \
+	X(I_setStrokeWidth,                fI_setStrokeWidth) \
+	X(I_inc,                           fI_inc) \
+	X(I_dec,                           fI_dec) \
+	X(I_graphicsFlip,                  fI_graphicsFlip) \
+	X(I_newLine,                       fI_TODO) \
+	X(I_ask,                           fI_ask) \
+	X(I_setCloudVar,                   fI_TODO) \
+	X(I_getCloudVar,                   fI_TODO) \
+	X(I_indexOfChar,                   fI_indexOfChar) \
+	X(I_goto,                          fI_goto) \
+	X(I_imalloc,                       fI_imalloc) \
+	X(I_getValueAtPointer,             fI_TODO) \
+	X(I_setValueAtPointer,             fI_TODO) \
+	X(I_runtimeMillis,                 fI_TODO) \
+	X(I_free,                          fI_free) \
+	X(I_getVarAddress,                 fI_getVarAddress) \
+	X(I_setVarAddress,                 fI_setVarAddress) \
+	X(I_copyVar,                       fI_TODO) \
+	X(I_incA,                          fI_TODO) \
+	X(I_decA,                          fI_TODO) \
+	X(I_arrayBoundsCheck,              fI_TODO) \
+	X(I_getValueAtPointerOfA,          fI_TODO) \
+	X(I_stackPushA,                    fI_stackPushA) \
+	X(I_stackPopA,                     fI_stackPopA) \
+	X(I_stackPush,                     fI_stackPush) \
+	X(I_stackPop,                      fI_stackPop) \
+	X(I_stackPeekA,                    fI_stackPeekA) \
+	X(I_stackPeek,                     fI_stackPeek) \
+	X(I_stackInc,                      fI_stackInc) \
+	X(I_stackDec,                      fI_stackDec) \
+	X(I_stackAdd,                      fI_stackAdd) \
+	X(I_stackSub,                      fI_stackSub) \
+	X(I_stackMul,                      fI_stackMul) \
+	X(I_stackDiv,                      fI_stackDiv) \
+	X(I_stackBitwiseLsf,               fI_stackBitwiseLsf) \
+	X(I_stackBitwiseRsf,               fI_stackBitwiseRsf) \
+	X(I_stackBitwiseAnd,               fI_stackBitwiseAnd) \
+	X(I_stackBitwiseOr,                fI_stackBitwiseOr) \
+	X(I_stackMod,                      fI_stackMod) \
+	X(I_stackBoolAnd,                  fI_stackBoolAnd) \
+	X(I_stackBoolOr,                   fI_stackBoolOr) \
+	X(I_stackBoolEqual,                fI_stackBoolEqual) \
+	X(I_stackLargerThanOrEqual,        fI_stackLargerThanOrEqual) \
+	X(I_stackSmallerThanOrEqual,       fI_stackSmallerThanOrEqual) \
+	X(I_stackNotEqual,                 fI_stackNotEqual) \
+	X(I_stackSmallerThan,              fI_stackSmallerThan) \
+	X(I_stackLargerThan,               fI_stackLargerThan) \
+	X(I_conditionalValueSet,           fI_TODO) \
+	X(I_loadAddStore,                  fI_loadAddStore) \
+	X(I_loadSubStore,                  fI_loadSubStore) \
+	X(I_ldiStore,                      fI_ldiStore) \
+	X(I_loadSmallerThanJf,             fI_loadSmallerThanJf) \
+	X(I_loadLargerThanJf,              fI_loadLargerThanJf) \
+	X(I_incJmp,                        fI_incJmp) \
+	X(I_decJmp,                        fI_decJmp) \
+	X(I_addWithVarNum,                 fI_addWithVarNum) \
+	X(I_subWithVarNum,                 fI_subWithVarNum) \
+	X(I_mulWithVarNum,                 fI_mulWithVarNum) \
+	X(I_divWithVarNum,                 fI_divWithVarNum) \
+	X(I_bitwiseLsfWithVarNum,          fI_bitwiseLsfWithVarNum) \
+	X(I_bitwiseRsfWithVarNum,          fI_bitwiseRsfWithVarNum) \
+	X(I_bitwiseAndWithVarNum,          fI_bitwiseAndWithVarNum) \
+	X(I_bitwiseOrWithVarNum,           fI_bitwiseOrWithVarNum) \
+	X(I_modWithVarNum,                 fI_modWithVarNum) \
+	X(I_boolAndWithVarNum,             fI_boolAndWithVarNum) \
+	X(I_boolOrWithVarNum,              fI_boolOrWithVarNum) \
+	X(I_boolEqualWithVarNum,           fI_boolEqualWithVarNum) \
+	X(I_largerThanOrEqualWithVarNum,   fI_largerThanOrEqualWithVarNum) \
+	X(I_smallerThanOrEqualWithVarNum,  fI_smallerThanOrEqualWithVarNum) \
+	X(I_boolNotEqualWithVarNum,        fI_boolNotEqualWithVarNum) \
+	X(I_smallerThanWithVarNum,         fI_smallerThanWithVarNum) \
+	X(I_largerThanWithVarNum,          fI_largerThanWithVarNum)
+
+// whether the handler of an instruction can stop the program. run() only
+// checks `running` after these, and they end their basic block, see cfg.cpp.
+// instructions without a handler are not listed, load() rejects them
+constexpr bool instruction_may_stop(Instruction op) {
+	switch (op) {
+		case I_jts:
+		case I_ret:
+		case I_done:
+		case I_malloc:
+		case I_imalloc:
+		case I_free:
+		case I_join:
+		case I_setVarAddress:
+		case I_stackPopA:
+		case I_stackPop:
+		case I_stackPeekA:
+		case I_stackPeek:
+		case I_stackInc:
+		case I_stackDec:
+		case I_stackAdd:
+		case I_stackSub:
+		case I_stackMul:
+		case I_stackDiv:
+		case I_stackBitwiseLsf:
+		case I_stackBitwiseRsf:
+		case I_stackBitwiseAnd:
+		case I_stackBitwiseOr:
+		case I_stackMod:
+		case I_stackBoolAnd:
+		case I_stackBoolOr:
+		case I_stackBoolEqual:
+		case I_stackLargerThanOrEqual:
+		case I_stackSmallerThanOrEqual:
+		case I_stackNotEqual:
+		case I_stackSmallerThan:
+		case I_stackLargerThan:
+			return true;
+		default:
+			return false;
+	}
+}
+
 namespace Instructions {
-	Instruction last_impl = I_mouseY;
 	// why are the function arguments r padded?
 	// because no one stopped me.
-	void fI_ldi                       (SLVM_state * state, std::string code[]) {
-		state->accumulator.set_string(code[state->instruction_pointer + 1]);
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
-	}
-	void fI_loadAtVar                 (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
-		state->accumulator.value = state->memory[addr].value;
-		state->accumulator.is_num = state->memory[addr].is_num;
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
-	}
-	void fI_storeAtVar                (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
-		state->memory[addr].value = state->accumulator.value;
-		state->memory[addr].is_num = state->accumulator.is_num;
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
-	}
-	void fI_jts                       (SLVM_state * state, std::string code[]) {
+
+	// quickening. when an arithmetic or comparison instruction finds
+	// computed numbers on both sides, it rewrites itself into its ...Num
+	// variant, which does not have to look at what the cells hold beyond
+	// one check. the variant rewrites itself back as soon as it finds
+	// anything else, and an instruction that went back QUICKEN_LIMIT times
+	// stays generic. the count is kept in args[3], which they do not use.
+	// `ins` is always the instruction in state->code
+	inline void quicken(SLVM_state * state, const DecodedInstruction & ins, const MemoryCell & operand, Instruction quick) {
+		if (state->quicken && ins.args[3] < QUICKEN_LIMIT && state->accumulator.holds_num() && operand.holds_num())
+			const_cast<DecodedInstruction &>(ins).op = quick;
+	}
+	inline void fI_ldi                (SLVM_state * state, const DecodedInstruction & ins) {
+		state->accumulator.set_constant(&state->program->constants[ins.args[0]]);
+	}
+	inline void fI_loadAtVar          (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		state->accumulator.copy_from(state->memory[addr]);
+	}
+	inline void fI_storeAtVar         (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		state->memory[addr].copy_from(state->accumulator);
+	}
+	inline void fI_jts                (SLVM_state * state, const DecodedInstruction & ins) {
 		// jump to stack
-		addr_t addr = atoi(code[state->instruction_pointer + 1].c_str());
-		state->call_stack.push(state->instruction_pointer + 1);
-		state->instruction_pointer = addr - 1;
+		if (!state->call_stack.push(state->instruction_pointer)) {
+			state->report("Error: call stack overflow @ %i\n", ins.line + 1);
+			state->running = false;
+			return;
+		}
+		state->instruction_pointer = ins.args[0] - 1;
 	}
-	void fI_ret                       (SLVM_state * state, std::string code[]) {
+	inline void fI_ret                (SLVM_state * state, const DecodedInstruction & ins) {
 		// return from stack
-		state->instruction_pointer = state->call_stack.top();
-		state->call_stack.pop();
+		if (state->call_stack.empty()) {
+			state->report("Error: ret without jts @ %i\n", ins.line + 1);
+			state->running = false;
+			return;
+		}
+		state->instruction_pointer = state->call_stack.pop();
 	}
-	void fI_addWithVar                (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_addWithVar         (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_addWithVarNum);
 		state->accumulator.set_num(state->accumulator.get_num() + state->memory[addr].get_num());
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_subWithVar                (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_subWithVar         (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_subWithVarNum);
 		state->accumulator.set_num(state->accumulator.get_num() - state->memory[addr].get_num());
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_mulWithVar                (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_mulWithVar         (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_mulWithVarNum);
 		state->accumulator.set_num(state->accumulator.get_num() * state->memory[addr].get_num());
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_divWithVar                (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_divWithVar         (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_divWithVarNum);
 		state->accumulator.set_num(state->accumulator.get_num() / state->memory[addr].get_num());
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_bitwiseLsfWithVar         (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_bitwiseLsfWithVar  (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_bitwiseLsfWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) << addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_bitwiseRsfWithVar         (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_bitwiseRsfWithVar  (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_bitwiseRsfWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) >> addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_bitwiseAndWithVar         (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_bitwiseAndWithVar  (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_bitwiseAndWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) & addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_bitwiseOrWithVar          (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_bitwiseOrWithVar   (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_bitwiseOrWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) | addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_modWithVar                (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_modWithVar         (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_modWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) % addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_print                     (SLVM_state * state, std::string code[]) {
-		printf("%s",state->accumulator.get_string().c_str());
+	inline void fI_print              (SLVM_state * state, const DecodedInstruction &) {
+		char scratch[NUMBER_TEXT_SIZE];
+		std::string_view s = state->accumulator.get_view(scratch);
+		state->write_output(s.data(), s.size());
 	}
-	void fI_println                   (SLVM_state * state, std::string code[]) {
-		printf("%s\n",state->accumulator.get_string().c_str());
+	inline void fI_println            (SLVM_state * state, const DecodedInstruction &) {
+		char scratch[NUMBER_TEXT_SIZE];
+		std::string_view s = state->accumulator.get_view(scratch);
+		state->write_output(s.data(), s.size());
+		state->write_output("\n", 1);
 	}
-	void fI_jmp                       (SLVM_state * state, std::string code[]) {
-		addr_t addr = atoi(code[state->instruction_pointer + 1].c_str());
-		state->instruction_pointer = addr - 1;
+	inline void fI_jmp                (SLVM_state * state, const DecodedInstruction & ins) {
+		state->instruction_pointer = ins.args[0] - 1;
 	}
-	void fI_jt                        (SLVM_state * state, std::string code[]) {
-		addr_t addr = atoi(code[state->instruction_pointer + 1].c_str());
-		if (state->accumulator.get_num() > 0){
-			printf("yas queen\n");
-			state->instruction_pointer = addr - 1;
-		}
-		else
-			state->instruction_pointer++;
+	inline void fI_jt                 (SLVM_state * state, const DecodedInstruction & ins) {
+		if (state->accumulator.get_num() > 0)
+			state->instruction_pointer = ins.args[0] - 1;
 	}
-	void fI_jf                        (SLVM_state * state, std::string code[]) {
-		addr_t addr = atoi(code[state->instruction_pointer + 1].c_str());
-		if (state->accumulator.get_num() < 1){
-			printf("hahahaha\n");
-			state->instruction_pointer = addr - 1;
-		}
-		else
-			state->instruction_pointer++;
+	inline void fI_jf                 (SLVM_state * state, const DecodedInstruction & ins) {
+		if (state->accumulator.get_num() < 1)
+			state->instruction_pointer = ins.args[0] - 1;
 	}
-	void fI_boolAndWithVar            (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_boolAndWithVar     (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_boolAndWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) && addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_boolOrWithVar             (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_boolOrWithVar      (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_boolOrWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) || addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_boolEqualWithVar          (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_boolEqualWithVar   (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_boolEqualWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) == addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_largerThanOrEqualWithVar  (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_largerThanOrEqualWithVar (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_largerThanOrEqualWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) >= addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_smallerThanOrEqualWithVar (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_smallerThanOrEqualWithVar (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_smallerThanOrEqualWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) <= addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_boolNotEqualWithVar       (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_boolNotEqualWithVar (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_boolNotEqualWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) != addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_smallerThanWithVar        (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_smallerThanWithVar (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_smallerThanWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) < addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_largerThanWithVar         (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_largerThanWithVar  (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		quicken(state, ins, state->memory[addr], I_largerThanWithVarNum);
 		state->accumulator.set_num(addr_t(state->accumulator.get_num()) > addr_t(state->memory[addr].get_num()));
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
 	}
-	void fI_putPixel                  (SLVM_state * state, std::string code[]) {
-		addr_t x = state->get_var(code[state->instruction_pointer + 1]);
-		addr_t y = state->get_var(code[state->instruction_pointer + 2]);
+	inline void fI_putPixel           (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t x = get_var_with_offset(1);
+		addr_t y = get_var_with_offset(2);
 
 		GraphicInstruction gi;
 		gi.instruction = GI_P_PX;
 		gi.data.D_GI_P_PX.x = state->memory[x].get_num();
 		gi.data.D_GI_P_PX.y = state->memory[y].get_num();
-		state->graphic_queue.push(gi);
-
-		state->instruction_pointer += 2;
+		state->graphics.push(gi);
 	}
-	void fI_putLine                   (SLVM_state * state, std::string code[]) {
-		addr_t x0 = state->get_var(code[state->instruction_pointer + 1]);
-		addr_t y0 = state->get_var(code[state->instruction_pointer + 2]);
-		addr_t x1 = state->get_var(code[state->instruction_pointer + 1]);
-		addr_t y1 = state->get_var(code[state->instruction_pointer + 2]);
+	inline void fI_putLine            (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t x0 = get_var_with_offset(1);
+		addr_t y0 = get_var_with_offset(2);
+		addr_t x1 = get_var_with_offset(3);
+		addr_t y1 = get_var_with_offset(4);
 
 		GraphicInstruction gi;
 		gi.instruction = GI_P_LN;
@@ -384,15 +1002,13 @@ namespace Instructions {
 		gi.data.D_GI_P_LN.y0 = state->memory[y0].get_num();
 		gi.data.D_GI_P_LN.x1 = state->memory[x1].get_num();
 		gi.data.D_GI_P_LN.y1 = state->memory[y1].get_num();
-		state->graphic_queue.push(gi);
-
-		state->instruction_pointer += 2;
+		state->graphics.push(gi);
 	}
-	void fI_putRect                   (SLVM_state * state, std::string code[]) {
-		addr_t x = state->get_var(code[state->instruction_pointer + 1]);
-		addr_t y = state->get_var(code[state->instruction_pointer + 2]);
-		addr_t w = state->get_var(code[state->instruction_pointer + 1]);
-		addr_t h = state->get_var(code[state->instruction_pointer + 2]);
+	inline void fI_putRect            (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t x = get_var_with_offset(1);
+		addr_t y = get_var_with_offset(2);
+		addr_t w = get_var_with_offset(3);
+		addr_t h = get_var_with_offset(4);
 
 		GraphicInstruction gi;
 		gi.instruction = GI_P_REC;
@@ -400,33 +1016,40 @@ namespace Instructions {
 		gi.data.D_GI_P_REC.y = state->memory[y].get_num();
 		gi.data.D_GI_P_REC.w = state->memory[w].get_num();
 		gi.data.D_GI_P_REC.h = state->memory[h].get_num();
-		state->graphic_queue.push(gi);
-
-		state->instruction_pointer += 2;
+		state->graphics.push(gi);
 	}
-	void fI_setColor                  (SLVM_state * state, std::string code[]) {
+	inline void fI_setColor           (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t c = get_var_with_offset(1);
 		GraphicInstruction gi;
 		gi.instruction = GI_S_CL;
 		gi.data.D_GI_S_CL.cl = state->memory[c].get_num();
-		state->graphic_queue.push(gi);
-		state->instruction_pointer ++;
+		state->graphics.push(gi);
 	}
-	void fI_clg                       (SLVM_state * state, std::string code[]) {
-		while (!state->graphic_queue.empty())
-			state->graphic_queue.pop();
+	inline void fI_clg                (SLVM_state * state, const DecodedInstruction &) {
+		state->graphics.mark(GI_CLEAR);
 	}
-	void fI_done                      (SLVM_state * state, std::string code[]) {
+	inline void fI_done               (SLVM_state * state, const DecodedInstruction &) {
 		state->running = false;
+		state->finished = true;
 	}
-	void fI_malloc                    (SLVM_state * state, std::string code[]) {
+	inline void fI_malloc             (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t size = get_var_with_offset(1);
 
 		state->accumulator.set_num(
 			state->allocate_memory(state->memory[size].get_num())
 		);
 	}
-	void fI_round                     (SLVM_state * state, std::string code[]) {
+	inline void fI_imalloc            (SLVM_state * state, const DecodedInstruction & ins) {
+		state->accumulator.set_num(
+			state->allocate_memory(ins.args[0])
+		);
+	}
+	inline void fI_free               (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		addr_t size = get_var_with_offset(2);
+		state->deallocate_memory(m_get_num(addr), m_get_num(size));
+	}
+	inline void fI_round              (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t val = get_var_with_offset(1);
 		addr_t places = get_var_with_offset(2);
 
@@ -435,10 +1058,8 @@ namespace Instructions {
 		state->accumulator.set_num(
 			round(m_get_num(val) * pow10) / pow10
 		);
-		state->instruction_pointer ++;
-		state->instruction_pointer ++;
 	}
-	void fI_floor                     (SLVM_state * state, std::string code[]) {
+	inline void fI_floor              (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t val = get_var_with_offset(1);
 		addr_t places = get_var_with_offset(2);
 
@@ -447,10 +1068,8 @@ namespace Instructions {
 		state->accumulator.set_num(
 			floor(m_get_num(val) * pow10) / pow10
 		);
-		state->instruction_pointer ++;
-		state->instruction_pointer ++;
 	}
-	void fI_ceil                      (SLVM_state * state, std::string code[]) {
+	inline void fI_ceil               (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t val = get_var_with_offset(1);
 		addr_t places = get_var_with_offset(2);
 
@@ -459,207 +1078,593 @@ namespace Instructions {
 		state->accumulator.set_num(
 			ceil(m_get_num(val) * pow10) / pow10
 		);
-		state->instruction_pointer ++;
-		state->instruction_pointer ++;
 	}
-	void fI_sin                       (SLVM_state * state, std::string code[]) {
+	inline void fI_sin                (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t val = get_var_with_offset(1);
 
 		state->accumulator.set_num(
 			sin(m_get_num(val))
 		);
-		state->instruction_pointer ++;
 	}
-	void fI_cos                       (SLVM_state * state, std::string code[]) {
+	inline void fI_cos                (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t val = get_var_with_offset(1);
 
 		state->accumulator.set_num(
-			sin(m_get_num(val))
+			cos(m_get_num(val))
 		);
-		state->instruction_pointer ++;
 	}
-	void fI_sqrt                      (SLVM_state * state, std::string code[]) {
+	inline void fI_sqrt               (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t val = get_var_with_offset(1);
 
 		state->accumulator.set_num(
 			sqrt(m_get_num(val))
 		);
-		state->instruction_pointer ++;
 	}
-	void fI_atan2                     (SLVM_state * state, std::string code[]) {
+	inline void fI_atan2              (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t a = get_var_with_offset(1);
 		addr_t b = get_var_with_offset(2);
 
 		state->accumulator.set_num(
 			atan2(m_get_num(a),m_get_num(b))
 		);
-		state->instruction_pointer ++;
-		state->instruction_pointer ++;
 	}
 	// TODO: fI_mouseDown, fI_mouseX, fI_mouseY
-	void fI_sleep                     (SLVM_state * state, std::string code[]) {
+	inline void fI_sleep              (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t time = get_var_with_offset(1);
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(m_get_num(time)));
-
-		state->instruction_pointer ++;
+		std::this_thread::sleep_for(std::chrono::milliseconds((long)m_get_num(time)));
 	}
-	void fI_drawText                  (SLVM_state * state, std::string code[]) {
+	inline void fI_drawText           (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t text = get_var_with_offset(1);
 
-		GraphicInstruction gi;
-
-		gi.instruction = GI_P_TXT;
-		gi.data.D_GI_P_TXT.text = new std::string(m_get_str(text));
-
-		state->graphic_queue(gi);
+		char scratch[NUMBER_TEXT_SIZE];
+		std::string_view s = state->memory[text].get_view(scratch);
+		state->graphics.push_text(s.data(), s.size());
 	}
-	void fI_loadAtVarWithOffset       (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_loadAtVarWithOffset (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
 		addr_t offset = get_var_with_offset(2);
 		addr += m_get_num(offset);
-		state->accumulator.value = state->memory[addr].value;
-		state->accumulator.is_num = state->memory[addr].is_num;
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
+		state->accumulator.copy_from(state->memory[addr]);
 	}
-	void fI_storeAtVarWithOffset      (SLVM_state * state, std::string code[]) {
-		addr_t addr = state->get_var(code[state->instruction_pointer + 1]);
+	inline void fI_storeAtVarWithOffset (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
 		addr_t offset = get_var_with_offset(2);
 		addr += m_get_num(offset);
-		state->memory[addr].value = state->accumulator.value;
-		state->memory[addr].is_num = state->accumulator.is_num;
-		state->instruction_pointer ++; // it will be incremented by the caller a second time
+		state->memory[addr].copy_from(state->accumulator);
 	}
 	// TODO: fI_isKeyPressed
-	void fI_createColor               (SLVM_state * state, std::string code[]) {
+	inline void fI_createColor        (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t r = get_var_with_offset(1);
 		addr_t g = get_var_with_offset(2);
 		addr_t b = get_var_with_offset(3);
-		// do ***math***
 		state->accumulator.set_num(
-			int(m_get_num(r)) << 16 +
-			int(m_get_num(g)) << 8  +
+			(int(m_get_num(r)) << 16) +
+			(int(m_get_num(g)) << 8) +
 			int(m_get_num(b))
 		);
-		state->instruction_pointer ++;
-		state->instruction_pointer ++;
-		state->instruction_pointer ++;
 	}
-	void fI_charAt                    (SLVM_state * state, std::string code[]) {
+	// the string instructions read their operands in place, see
+	// MemoryCell::get_view
+	inline void fI_charAt             (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t text = get_var_with_offset(1);
 		addr_t index = get_var_with_offset(2);
 
-		state->accumulator.set_string(
-			{m_get_str(text)[m_get_num(index)]}
-		);
-		state->instruction_pointer ++;
-		state->instruction_pointer ++;
+		char scratch[NUMBER_TEXT_SIZE];
+		std::string_view s = state->memory[text].get_view(scratch);
+		num_t i = m_get_num(index);
+		// outside the string is the empty string
+		if (!(i >= 0 && i < s.size())) {
+			state->accumulator.set_string(state->strings.create("", 0));
+			return;
+		}
+		state->accumulator.set_string(state->strings.create(&s[(size_t)i], 1));
 	}
-	void fI_sizeOf                    (SLVM_state * state, std::string code[]) {
+	inline void fI_sizeOf             (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t text = get_var_with_offset(1);
 
+		char scratch[NUMBER_TEXT_SIZE];
 		state->accumulator.set_num(
-			m_get_str(text).length()
+			state->memory[text].get_size(scratch)
 		);
-		state->instruction_pointer ++;
 	}
-	void fI_contains                  (SLVM_state * state, std::string code[]) {
+	// 1 if the second string is part of the first, else 0
+	inline void fI_contains           (SLVM_state * state, const DecodedInstruction & ins) {
 		addr_t text = get_var_with_offset(1);
 		addr_t sub_text = get_var_with_offset(2);
 
+		char scratch[NUMBER_TEXT_SIZE];
+		char sub_scratch[NUMBER_TEXT_SIZE];
 		state->accumulator.set_num(
-			m_get_str(text).find(sub_text)
+			find_text(state->memory[text].get_view(scratch), state->memory[sub_text].get_view(sub_scratch)) >= 0
 		);
+	}
+	// long joins are kept as ropes, see StringHeap::join, so building a
+	// string one piece at a time does not copy it over and over
+	inline void fI_join               (SLVM_state * state, const DecodedInstruction & ins) {
+		MemoryCell & a = state->memory[get_var_with_offset(1)];
+		MemoryCell & b = state->memory[get_var_with_offset(2)];
+		StringHeap & strings = state->strings;
+
+		// numbers and constants are written out once. strings are only read
+		// when they are copied, which keeps ropes from being flattened
+		char a_scratch[NUMBER_TEXT_SIZE];
+		char b_scratch[NUMBER_TEXT_SIZE];
+		HeapString * a_string = a.heap_string();
+		HeapString * b_string = b.heap_string();
+		std::string_view a_text = a_string ? std::string_view() : a.get_view(a_scratch);
+		std::string_view b_text = b_string ? std::string_view() : b.get_view(b_scratch);
+		size_t a_size = a_string ? a_string->size : a_text.size();
+		size_t b_size = b_string ? b_string->size : b_text.size();
+		if (a_size + b_size > UINT32_MAX) {
+			state->report("Error: string too long @ %i\n", ins.line + 1);
+			state->running = false;
+			return;
+		}
+		if (a_size + b_size < StringHeap::ROPE_MIN) {
+			if (a_string)
+				a_text = a.get_view(a_scratch);
+			if (b_string)
+				b_text = b.get_view(b_scratch);
+			state->accumulator.set_string(strings.concat(a_text, b_text));
+			return;
+		}
+		HeapString * left = a_string;
+		if (left)
+			retain(left);
+		else
+			left = strings.create(a_text.data(), a_text.size());
+		if (b_size < StringHeap::ROPE_MIN) {
+			if (b_string)
+				b_text = b.get_view(b_scratch);
+			state->accumulator.set_string(strings.append(left, b_text));
+			return;
+		}
+		HeapString * right = b_string;
+		if (right)
+			retain(right);
+		else
+			right = strings.create(b_text.data(), b_text.size());
+		state->accumulator.set_string(strings.join(left, right));
+	}
+	inline void fI_setStrokeWidth     (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t w = get_var_with_offset(1);
+		GraphicInstruction gi;
+		gi.instruction = GI_S_SW;
+		gi.data.D_GI_S_SW.w = state->memory[w].get_num();
+		state->graphics.push(gi);
+	}
+	inline void fI_inc                (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		state->memory[addr].set_num(m_get_num(addr) + 1);
+	}
+	inline void fI_dec                (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t addr = get_var_with_offset(1);
+		state->memory[addr].set_num(m_get_num(addr) - 1);
+	}
+	inline void fI_graphicsFlip       (SLVM_state * state, const DecodedInstruction &) {
+		state->graphics.mark(GI_FLIP);
+	}
+	// the index of the first character of the second string in the first,
+	// or -1
+	inline void fI_indexOfChar        (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t text = get_var_with_offset(1);
+		addr_t c = get_var_with_offset(2);
+
+		char scratch[NUMBER_TEXT_SIZE];
+		char c_scratch[NUMBER_TEXT_SIZE];
+		std::string_view s = state->memory[text].get_view(scratch);
+		std::string_view chars = state->memory[c].get_view(c_scratch);
+		state->accumulator.set_num(chars.empty() ? -1 : find_char(s, chars[0]));
+	}
+	// asks the accumulator as a question and replaces it with the answer,
+	// the empty string if there is none
+	inline void fI_ask                (SLVM_state * state, const DecodedInstruction &) {
+		char scratch[NUMBER_TEXT_SIZE];
+		std::string answer;
+		state->read_input(state->accumulator.get_view(scratch), answer);
+		state->accumulator.set_string(state->strings.create(answer));
+	}
+	inline void fI_goto               (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t x = get_var_with_offset(1);
+		addr_t y = get_var_with_offset(2);
+
+		GraphicInstruction gi;
+		gi.instruction = GI_GOTO;
+		gi.data.D_GI_GOTO.x = state->memory[x].get_num();
+		gi.data.D_GI_GOTO.y = state->memory[y].get_num();
+		state->graphics.push(gi);
+	}
+	inline void fI_getVarAddress      (SLVM_state * state, const DecodedInstruction & ins) {
+		state->accumulator.set_num(get_var_with_offset(1));
+	}
+	inline void fI_setVarAddress      (SLVM_state * state, const DecodedInstruction & ins) {
+		// compared as doubles, so NaN, infinities and addresses past what a
+		// float holds exactly are all caught before they become an addr_t
+		double addr = state->accumulator.get_num();
+		if (!(addr >= 0 && addr < (double)state->memory_backend.size)) {
+			state->report("Error: address %g out of range @ %i\n", addr, ins.line + 1);
+			state->running = false;
+			return;
+		}
+		state->set_var_address(ins.args[0], (addr_t)addr);
+	}
+
+	// the data stack. binary operations pop the right operand, then the
+	// left one, and push the result
+	inline bool stack_check(SLVM_state * state, const DecodedInstruction & ins, size_t needed) {
+		if (state->data_stack.size() >= needed)
+			return true;
+		state->report("Error: data stack underflow @ %i\n", ins.line + 1);
+		state->running = false;
+		return false;
+	}
+	template <typename F>
+	inline void stack_binary(SLVM_state * state, const DecodedInstruction & ins, F f) {
+		if (!stack_check(state, ins, 2))
+			return;
+		num_t b = state->data_stack.top().get_num();
+		state->data_stack.pop();
+		state->data_stack.top().set_num(f(state->data_stack.top().get_num(), b));
+	}
+	inline void fI_stackPushA         (SLVM_state * state, const DecodedInstruction &) {
+		state->data_stack.push(state->accumulator);
+	}
+	inline void fI_stackPopA          (SLVM_state * state, const DecodedInstruction & ins) {
+		if (!stack_check(state, ins, 1))
+			return;
+		state->accumulator = state->data_stack.top();
+		state->data_stack.pop();
+	}
+	inline void fI_stackPush          (SLVM_state * state, const DecodedInstruction & ins) {
+		state->data_stack.push(state->memory[get_var_with_offset(1)]);
+	}
+	inline void fI_stackPop           (SLVM_state * state, const DecodedInstruction & ins) {
+		if (!stack_check(state, ins, 1))
+			return;
+		state->memory[get_var_with_offset(1)] = state->data_stack.top();
+		state->data_stack.pop();
+	}
+	inline void fI_stackPeekA         (SLVM_state * state, const DecodedInstruction & ins) {
+		if (stack_check(state, ins, 1))
+			state->accumulator = state->data_stack.top();
+	}
+	inline void fI_stackPeek          (SLVM_state * state, const DecodedInstruction & ins) {
+		if (stack_check(state, ins, 1))
+			state->memory[get_var_with_offset(1)] = state->data_stack.top();
+	}
+	inline void fI_stackInc           (SLVM_state * state, const DecodedInstruction & ins) {
+		if (stack_check(state, ins, 1))
+			state->data_stack.top().set_num(state->data_stack.top().get_num() + 1);
+	}
+	inline void fI_stackDec           (SLVM_state * state, const DecodedInstruction & ins) {
+		if (stack_check(state, ins, 1))
+			state->data_stack.top().set_num(state->data_stack.top().get_num() - 1);
+	}
+	inline void fI_stackAdd           (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(a + b); });
+	}
+	inline void fI_stackSub           (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(a - b); });
+	}
+	inline void fI_stackMul           (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(a * b); });
+	}
+	inline void fI_stackDiv           (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(a / b); });
+	}
+	inline void fI_stackBitwiseLsf    (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) << addr_t(b)); });
+	}
+	inline void fI_stackBitwiseRsf    (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) >> addr_t(b)); });
+	}
+	inline void fI_stackBitwiseAnd    (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) & addr_t(b)); });
+	}
+	inline void fI_stackBitwiseOr     (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) | addr_t(b)); });
+	}
+	inline void fI_stackMod           (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) % addr_t(b)); });
+	}
+	inline void fI_stackBoolAnd       (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) && addr_t(b)); });
+	}
+	inline void fI_stackBoolOr        (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) || addr_t(b)); });
+	}
+	inline void fI_stackBoolEqual     (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) == addr_t(b)); });
+	}
+	inline void fI_stackLargerThanOrEqual(SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) >= addr_t(b)); });
+	}
+	inline void fI_stackSmallerThanOrEqual(SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) <= addr_t(b)); });
+	}
+	inline void fI_stackNotEqual      (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) != addr_t(b)); });
+	}
+	inline void fI_stackSmallerThan   (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) < addr_t(b)); });
+	}
+	inline void fI_stackLargerThan    (SLVM_state * state, const DecodedInstruction & ins) {
+		stack_binary(state, ins, [](num_t a, num_t b) { return num_t(addr_t(a) > addr_t(b)); });
+	}
+
+	// superinstructions, see InstructionStorage::fuse.
+	// each one skips the instructions it replaced
+	inline void fI_loadAddStore       (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t a = get_var_with_offset(1);
+		addr_t b = get_var_with_offset(2);
+		addr_t c = get_var_with_offset(3);
+		state->accumulator.set_num(m_get_num(a) + m_get_num(b));
+		state->memory[c].set_num(state->accumulator.get_num());
+		state->instruction_pointer += 2;
+	}
+	inline void fI_loadSubStore       (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t a = get_var_with_offset(1);
+		addr_t b = get_var_with_offset(2);
+		addr_t c = get_var_with_offset(3);
+		state->accumulator.set_num(m_get_num(a) - m_get_num(b));
+		state->memory[c].set_num(state->accumulator.get_num());
+		state->instruction_pointer += 2;
+	}
+	inline void fI_ldiStore           (SLVM_state * state, const DecodedInstruction & ins) {
+		fI_ldi(state, ins);
+		addr_t addr = get_var_with_offset(2);
+		state->memory[addr].copy_from(state->accumulator);
 		state->instruction_pointer ++;
-		state->instruction_pointer ++;
+	}
+	inline void fI_loadSmallerThanJf  (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t a = get_var_with_offset(1);
+		addr_t b = get_var_with_offset(2);
+		bool result = addr_t(m_get_num(a)) < addr_t(m_get_num(b));
+		state->accumulator.set_num(result);
+		if (!result)
+			state->instruction_pointer = ins.args[2] - 1;
+		else
+			state->instruction_pointer += 2;
+	}
+	inline void fI_loadLargerThanJf   (SLVM_state * state, const DecodedInstruction & ins) {
+		addr_t a = get_var_with_offset(1);
+		addr_t b = get_var_with_offset(2);
+		bool result = addr_t(m_get_num(a)) > addr_t(m_get_num(b));
+		state->accumulator.set_num(result);
+		if (!result)
+			state->instruction_pointer = ins.args[2] - 1;
+		else
+			state->instruction_pointer += 2;
+	}
+	inline void fI_incJmp             (SLVM_state * state, const DecodedInstruction & ins) {
+		fI_inc(state, ins);
+		state->instruction_pointer = ins.args[1] - 1;
+	}
+	inline void fI_decJmp             (SLVM_state * state, const DecodedInstruction & ins) {
+		fI_dec(state, ins);
+		state->instruction_pointer = ins.args[1] - 1;
 	}
 
-	void fI_TODO                      (SLVM_state * state, std::string code[]) {
-		printf(
+	// quickened instructions, see quicken()
+	template <void (*generic)(SLVM_state *, const DecodedInstruction &), typename F>
+	inline void quick_binary(SLVM_state * state, const DecodedInstruction & ins, Instruction generic_op, F f) {
+		MemoryCell & operand = state->memory[get_var_with_offset(1)];
+		if (!state->accumulator.holds_num() || !operand.holds_num()) {
+			DecodedInstruction & self = const_cast<DecodedInstruction &>(ins);
+			self.op = generic_op;
+			self.args[3]++;
+			generic(state, ins);
+			return;
+		}
+		state->accumulator.set_num(f(state->accumulator.num(), operand.num()));
+	}
+	inline void fI_addWithVarNum      (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_addWithVar>(state, ins, I_addWithVar, [](num_t a, num_t b) { return num_t(a + b); });
+	}
+	inline void fI_subWithVarNum      (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_subWithVar>(state, ins, I_subWithVar, [](num_t a, num_t b) { return num_t(a - b); });
+	}
+	inline void fI_mulWithVarNum      (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_mulWithVar>(state, ins, I_mulWithVar, [](num_t a, num_t b) { return num_t(a * b); });
+	}
+	inline void fI_divWithVarNum      (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_divWithVar>(state, ins, I_divWithVar, [](num_t a, num_t b) { return num_t(a / b); });
+	}
+	inline void fI_bitwiseLsfWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_bitwiseLsfWithVar>(state, ins, I_bitwiseLsfWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) << addr_t(b)); });
+	}
+	inline void fI_bitwiseRsfWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_bitwiseRsfWithVar>(state, ins, I_bitwiseRsfWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) >> addr_t(b)); });
+	}
+	inline void fI_bitwiseAndWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_bitwiseAndWithVar>(state, ins, I_bitwiseAndWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) & addr_t(b)); });
+	}
+	inline void fI_bitwiseOrWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_bitwiseOrWithVar>(state, ins, I_bitwiseOrWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) | addr_t(b)); });
+	}
+	inline void fI_modWithVarNum      (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_modWithVar>(state, ins, I_modWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) % addr_t(b)); });
+	}
+	inline void fI_boolAndWithVarNum  (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_boolAndWithVar>(state, ins, I_boolAndWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) && addr_t(b)); });
+	}
+	inline void fI_boolOrWithVarNum   (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_boolOrWithVar>(state, ins, I_boolOrWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) || addr_t(b)); });
+	}
+	inline void fI_boolEqualWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_boolEqualWithVar>(state, ins, I_boolEqualWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) == addr_t(b)); });
+	}
+	inline void fI_largerThanOrEqualWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_largerThanOrEqualWithVar>(state, ins, I_largerThanOrEqualWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) >= addr_t(b)); });
+	}
+	inline void fI_smallerThanOrEqualWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_smallerThanOrEqualWithVar>(state, ins, I_smallerThanOrEqualWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) <= addr_t(b)); });
+	}
+	inline void fI_boolNotEqualWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_boolNotEqualWithVar>(state, ins, I_boolNotEqualWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) != addr_t(b)); });
+	}
+	inline void fI_smallerThanWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_smallerThanWithVar>(state, ins, I_smallerThanWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) < addr_t(b)); });
+	}
+	inline void fI_largerThanWithVarNum (SLVM_state * state, const DecodedInstruction & ins) {
+		quick_binary<fI_largerThanWithVar>(state, ins, I_largerThanWithVar, [](num_t a, num_t b) { return num_t(addr_t(a) > addr_t(b)); });
+	}
+
+	inline void fI_TODO               (SLVM_state * state, const DecodedInstruction & ins) {
+		state->report(
 			"Unimplemented instruction %s @ %i\n",
-			code[state->instruction_pointer].c_str(),
-			state->instruction_pointer + 1
+			instruction_name(ins.op).c_str(),
+			ins.line + 1
 		);
-		printf("You can help by contributing!\n");
+		state->report("You can help by contributing!\n");
 		state->running = false;
 	}
 
 	// thank you https://stackoverflow.com/a/5488718/12469275
-	void (*func[])(SLVM_state *state, std::string *code) = {
+	#define HANDLER_POINTER(op, f) f,
+	void (* const func[])(SLVM_state *state, const DecodedInstruction & ins) = {
 		NULL,
-		fI_ldi,
-		fI_loadAtVar,
-		fI_storeAtVar,
-		fI_jts,
-		fI_ret,
-		fI_addWithVar,
-		fI_subWithVar,
-		fI_mulWithVar,
-		fI_divWithVar,
-		fI_bitwiseLsfWithVar,
-		fI_bitwiseRsfWithVar,
-		fI_bitwiseAndWithVar,
-		fI_bitwiseOrWithVar,
-		fI_modWithVar,
-		fI_print,
-		fI_println,
-		fI_jmp,
-		fI_jt,
-		fI_jf,
-		fI_boolAndWithVar,
-		fI_boolOrWithVar,
-		fI_boolEqualWithVar,
-		fI_largerThanOrEqualWithVar,
-		fI_smallerThanOrEqualWithVar,
-		fI_boolNotEqualWithVar,
-		fI_smallerThanWithVar,
-		fI_largerThanWithVar,
-		fI_putPixel,
-		fI_putLine,
-		fI_putRect,
-		fI_setColor,
-		fI_clg,
-		fI_done,
-		fI_malloc,
-		fI_round,
-		fI_floor,
-		fI_ceil,
-		fI_sin,
-		fI_cos,
-		fI_sqrt,
-		fI_atan2,
-		fI_TODO, // I_mouseDown
-		fI_TODO, // I_mouseX
-		fI_TODO, // I_mouseY
+		SLVM_HANDLERS(HANDLER_POINTER)
 	};
+	#undef HANDLER_POINTER
 }
 
-void SLVM_state::process(InstructionStorage store) {
-		if (instruction_pointer >= store.size){
+void SLVM_state::process(InstructionStorage & store) {
+		if ((size_t)instruction_pointer >= store.code_size){
 			this->running = false;
 			return;
 		}
-		Instruction i = store.get_at(this->instruction_pointer);
-		if (!i){
-			printf(
-				"Unknown instruction %s @ %i\n",
-				store.values[this->instruction_pointer].c_str(),
-				this->instruction_pointer + 1
+		const DecodedInstruction & ins = store.code[this->instruction_pointer];
+		TRACE_STEP();
+		if (profiler)
+			profiler->enter(instruction_pointer, ins.op);
+		Instructions::func[ins.op](this,ins);
+		if (profiler)
+			profiler->leave(ins.op);
+		instruction_pointer++;
+	}
+
+bool SLVM_state::load(const InstructionStorage & store, bool copy_code) {
+	for (size_t i = 0; i < store.code_size; i++) {
+		const DecodedInstruction & ins = store.code[i];
+		if (Instructions::func[ins.op] == Instructions::fI_TODO) {
+			report(
+				"Unimplemented instruction %s @ %i\n",
+				instruction_name(ins.op).c_str(),
+				ins.line + 1
 			);
-			this->running = false;
-			return;
+			report("You can help by contributing!\n");
+			return false;
 		}
-		if (i > Instructions::last_impl){
-			printf(
-				"Unimplemented instruction %s @ %i (#%d)\n",
-				store.values[this->instruction_pointer].c_str(),
-				this->instruction_pointer + 1,
-				i
-			);
-			printf("You can help by contributing!\n");
-			this->running = false;
-			return;
+	}
+	program = &store;
+	if (copy_code) {
+		own_code.assign(store.code, store.code + store.code_size);
+		code = own_code.data();
+	} else {
+		own_code.clear();
+		code = store.code;
+	}
+	delete[] var_addr;
+	var_addr = new addr_t[store.names.size()];
+	for (size_t i = 0; i < store.names.size(); i++)
+		var_addr[i] = get_var(std::string(store.names[i]));
+	// get_var reported it, the variables would all be at address 0
+	return running;
+}
+
+// runs the loaded program until it stops. everything process() checks on
+// every step was already validated by decode() and load(), so this only
+// has to dispatch. `running` is only checked after the instructions that
+// can clear it, so the instructions of a basic block run back to back.
+void SLVM_state::run() {
+	// the loop is instantiated for each case, so not profiling and not
+	// running in slices costs nothing
+	if (profiler)
+		run_loop<true, false>();
+	else
+		run_loop<false, false>();
+}
+
+// runs at most `limit` instructions, a superinstruction counting as one,
+// and returns how many ran. the next call goes on where this one stopped.
+// inline, so the sliced loop is only instantiated by the hosts that use
+// it: every copy of the loop eats into the inlining budget of the others.
+// hosts do not profile, so there is no profiled slice
+inline uint64_t SLVM_state::run_slice(uint64_t limit) {
+	if (!running || limit == 0)
+		return 0;
+	slice_left = limit;
+	run_loop<false, true>();
+	return limit - slice_left;
+}
+
+template <bool profile, bool sliced>
+void SLVM_state::run_loop() {
+	const DecodedInstruction * code = this->code;
+	#define PROFILE_ENTER(op) \
+		if (profile) \
+			profiler->enter(instruction_pointer, op);
+	#define PROFILE_LEAVE(op) \
+		if (profile) \
+			profiler->leave(op);
+#ifdef SLVM_COMPUTED_GOTO
+	#define DISPATCH_LABEL(op, f) &&L_##op,
+	static void * labels[] = {
+		&&L_I_unknown,
+		SLVM_HANDLERS(DISPATCH_LABEL)
+	};
+	#undef DISPATCH_LABEL
+	#define DISPATCH() goto *labels[code[instruction_pointer].op]
+	#define HANDLER_CASE(op, f) \
+		L_##op: \
+			TRACE_STEP(); \
+			PROFILE_ENTER(op); \
+			Instructions::f(this, code[instruction_pointer]); \
+			PROFILE_LEAVE(op); \
+			instruction_pointer++; \
+			if (sliced) \
+				slice_left--; \
+			if (instruction_may_stop(op) && !running) \
+				return; \
+			if (sliced && slice_left == 0) \
+				return; \
+			DISPATCH();
+
+	DISPATCH();
+	L_I_unknown:
+		running = false;
+		return;
+	SLVM_HANDLERS(HANDLER_CASE)
+	#undef HANDLER_CASE
+	#undef DISPATCH
+#else
+	#define HANDLER_CASE(op, f) \
+		case op: \
+			PROFILE_ENTER(op); \
+			Instructions::f(this, code[instruction_pointer]); \
+			PROFILE_LEAVE(op); \
+			instruction_pointer++; \
+			if (sliced) \
+				slice_left--; \
+			if (instruction_may_stop(op) && !running) \
+				return; \
+			if (sliced && slice_left == 0) \
+				return; \
+			break;
+
+	while (true) {
+		TRACE_STEP();
+		switch (code[instruction_pointer].op) {
+			SLVM_HANDLERS(HANDLER_CASE)
+			default:
+				running = false;
+				return;
 		}
-		Instructions::func[i](this,store.values);
-		instruction_pointer++;
 	}
+	#undef HANDLER_CASE
+#endif
+	#undef PROFILE_ENTER
+	#undef PROFILE_LEAVE
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <iterator>
+#include "pre-parser.cpp"
+
+// hands out ranges of the VM address space.
+// free chunks are kept in two trees, one ordered by address for coalescing
+// and one ordered by size for best fit, so every operation is O(log n).
+// single cells, which is what every variable needs, are carved from a slab
+// with a bump pointer instead.
+struct Allocator {
+	static constexpr addr_t SLAB_SIZE = 64;
+
+	std::map<addr_t, addr_t> chunks;            // start -> length
+	std::set<std::pair<addr_t, addr_t>> sizes;  // <length, start>
+	addr_t slab_next;
+	addr_t slab_end;
+	addr_t size;       // size of the address space
+	addr_t allocated;  // cells currently handed out
+
+	void init(addr_t start, addr_t i_size) {
+		chunks.clear();
+		sizes.clear();
+		slab_next = slab_end = 0;
+		size = i_size;
+		allocated = 0;
+		add_chunk(start, i_size - start);
+	}
+
+	// returns the address of `length` free cells, or -1
+	addr_t allocate(addr_t length) {
+		if (length < 1)
+			return -1;
+		if (length == 1)
+			return allocate_cell();
+		addr_t addr = take(length);
+		if (addr < 0 && slab_next < slab_end) {
+			// the rest of the slab might be what we are missing
+			return_slab();
+			addr = take(length);
+		}
+		if (addr >= 0)
+			allocated += length;
+		return addr;
+	}
+
+	addr_t allocate_cell() {
+		if (slab_next == slab_end) {
+			// carve a new slab out of the smallest chunk that fits one,
+			// or whatever is left if none does
+			auto it = sizes.lower_bound({SLAB_SIZE, 0});
+			if (it == sizes.end()) {
+				if (sizes.empty())
+					return -1;
+				it = std::prev(sizes.end());
+			}
+			addr_t length = std::min(it->first, SLAB_SIZE);
+			slab_next = take(length);
+			slab_end = slab_next + length;
+		}
+		allocated++;
+		return slab_next++;
+	}
+
+	// returns false if the range is not allocated
+	bool deallocate(addr_t addr, addr_t length) {
+		if (length < 1 || addr < 0 || addr > size - length)
+			return false;
+		if (overlaps_slab(addr, length))
+			return false;
+		auto next = chunks.lower_bound(addr);
+		if (next != chunks.end() && next->first < addr + length)
+			return false;
+		auto prev = next == chunks.begin() ? chunks.end() : std::prev(next);
+		if (prev != chunks.end() && prev->first + prev->second > addr)
+			return false;
+
+		allocated -= length;
+		// coalesce with the neighbours
+		if (prev != chunks.end() && prev->first + prev->second == addr) {
+			addr = prev->first;
+			length += prev->second;
+			remove_chunk(prev);
+		}
+		if (next != chunks.end() && next->first == addr + length) {
+			length += next->second;
+			remove_chunk(next);
+		}
+		add_chunk(addr, length);
+		return true;
+	}
+
+	addr_t free_cells() {
+		addr_t total = slab_end - slab_next;
+		for (auto & c : chunks)
+			total += c.second;
+		return total;
+	}
+
+	addr_t largest_free() {
+		addr_t largest = slab_end - slab_next;
+		if (!sizes.empty())
+			largest = std::max(largest, sizes.rbegin()->first);
+		return largest;
+	}
+
+	void print_stats(FILE * out) {
+		addr_t total = free_cells();
+		addr_t largest = largest_free();
+		fprintf(
+			out,
+			"memory: %d cells allocated, %d free in %zu chunks, largest free chunk %d cells (%.1f%% fragmented)\n",
+			allocated, total, chunks.size(), largest,
+			total ? 100.0 * (1.0 - (double)largest / total) : 0.0
+		);
+	}
+
+	void add_chunk(addr_t start, addr_t length) {
+		chunks[start] = length;
+		sizes.insert({length, start});
+	}
+
+	void remove_chunk(std::map<addr_t, addr_t>::iterator it) {
+		sizes.erase({it->second, it->first});
+		chunks.erase(it);
+	}
+
+	// best fit: the smallest chunk that is big enough
+	addr_t take(addr_t length) {
+		auto it = sizes.lower_bound({length, 0});
+		if (it == sizes.end())
+			return -1;
+		addr_t start = it->second;
+		addr_t chunk_length = it->first;
+		sizes.erase(it);
+		chunks.erase(start);
+		if (chunk_length > length)
+			add_chunk(start + length, chunk_length - length);
+		return start;
+	}
+
+	void return_slab() {
+		addr_t addr = slab_next;
+		addr_t length = slab_end - slab_next;
+		slab_next = slab_end = 0;
+		allocated += length; // deallocate subtracts it again
+		deallocate(addr, length);
+	}
+
+	bool overlaps_slab(addr_t addr, addr_t length) {
+		return addr < slab_end && slab_next < addr + length;
+	}
+};
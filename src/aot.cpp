@@ -0,0 +1,61 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <string_view>
+#include <algorithm>
+#include "SLVM.cpp"
+
+// the runtime of programs translated to C++ by --emit-cpp, see transpile.cpp.
+// a translated program brings its instructions, names and constants as
+// tables and a function that runs them. memory, the allocator, the stacks
+// and the graphics queue are the interpreter's own, so the program behaves
+// exactly as it does when it is interpreted.
+
+struct CompiledProgram {
+	const DecodedInstruction * code;
+	size_t code_size;
+	const std::string_view * names;
+	size_t name_count;
+	const Constant * constants;
+	size_t constant_count;
+	addr_t memory_size; // the default, -m overrides it
+	void (*run)(SLVM_state * state);
+};
+
+// the main() of a translated program
+inline int run_compiled(const CompiledProgram & program, int argc, char * argv[]) {
+	addr_t memory_size = program.memory_size;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if ((arg == "-m" || arg == "--memory") && i + 1 < argc) {
+			long long cells = atoll(argv[++i]);
+			if (cells < 1 || cells > INT32_MAX) {
+				printf("Invalid memory size: %s\n", argv[i]);
+				return 1;
+			}
+			memory_size = cells;
+		} else {
+			printf("Unknown flag: `%s`\n", arg.c_str());
+		}
+	}
+
+	// the handlers find constants and names through the program, like
+	// they do when interpreting
+	InstructionStorage store;
+	store.code = new DecodedInstruction[program.code_size];
+	std::copy(program.code, program.code + program.code_size, store.code);
+	store.code_size = program.code_size;
+	store.names.assign(program.names, program.names + program.name_count);
+	store.constants.assign(program.constants, program.constants + program.constant_count);
+
+	SLVM_state state(memory_size);
+	if (!state.running)
+		return 1;
+	if (!state.load(store))
+		return 1;
+	// the instructions of a translated program are constants
+	state.quicken = false;
+	program.run(&state);
+	return 0;
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "SLVM.cpp"
+
+// --jobs: runs one program many times at once. the program is decoded once
+// and every run shares it; nothing they share is written while they go,
+// since every run has a state of its own that quickens its own copy of the
+// code, see SLVM_state::load. run k finds k in the variable `job` and, with
+// --job-inputs, line k of that file in `input`; ask gets no answers. what
+// a run prints is kept apart from the other runs and written out in order
+// once all are done.
+
+struct BatchRun {
+	std::string input;
+	std::string output;
+	double seconds;
+	bool loaded; // false if the program could not be loaded, see output
+};
+
+struct Batch {
+	const InstructionStorage * program;
+	addr_t memory_size;
+	std::vector<BatchRun> runs;
+	std::atomic<size_t> next;
+	size_t threads;
+	double seconds; // from the first run starting to the last one ending
+
+	Batch(const InstructionStorage * i_program, addr_t i_memory_size, size_t count) {
+		program = i_program;
+		memory_size = i_memory_size;
+		runs.resize(count);
+		next = 0;
+		threads = 0;
+		seconds = 0;
+	}
+
+	// reads one input per line. returns false if the file cannot be read
+	bool read_inputs(const std::string & path) {
+		FILE * in = fopen(path.c_str(), "rb");
+		if (!in)
+			return false;
+		std::vector<std::string> lines;
+		std::string line;
+		int c;
+		while ((c = fgetc(in)) != EOF) {
+			if (c != '\n') {
+				line += (char)c;
+				continue;
+			}
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			lines.push_back(line);
+			line.clear();
+		}
+		if (!line.empty())
+			lines.push_back(line);
+		fclose(in);
+		if (runs.empty())
+			runs.resize(lines.size());
+		// runs past the last line get an empty input
+		for (size_t k = 0; k < runs.size() && k < lines.size(); k++)
+			runs[k].input = lines[k];
+		return true;
+	}
+
+	static void capture(void * context, const char * text, size_t size) {
+		((std::string *)context)->append(text, size);
+	}
+
+	static bool no_input(void *, std::string_view, std::string &) {
+		return false;
+	}
+
+	void run_one(size_t k) {
+		BatchRun & run = runs[k];
+		auto start = std::chrono::steady_clock::now();
+		SLVM_state state(memory_size);
+		state.output = capture;
+		state.output_context = &run.output;
+		state.input = no_input;
+		run.loaded = state.running && state.load(*program, true);
+		if (run.loaded) {
+			addr_t job = state.get_var("job");
+			addr_t input = state.get_var("input");
+			// get_var reported it if they did not fit into memory
+			run.loaded = state.running;
+			if (run.loaded) {
+				state.memory[job].set_num(k);
+				state.memory[input].set_string(state.strings.create(run.input));
+				state.run();
+			}
+		}
+		run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void worker() {
+		for (size_t k = next++; k < runs.size(); k = next++)
+			run_one(k);
+	}
+
+	// `count` threads, or one per core for 0
+	void run(size_t count) {
+		if (count == 0)
+			count = std::thread::hardware_concurrency();
+		threads = std::max<size_t>(1, std::min(count, runs.size()));
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> pool;
+		for (size_t i = 1; i < threads; i++)
+			pool.emplace_back(&Batch::worker, this);
+		worker();
+		for (std::thread & t : pool)
+			t.join();
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	bool all_loaded() const {
+		for (const BatchRun & run : runs)
+			if (!run.loaded)
+				return false;
+		return true;
+	}
+
+	// what every run printed, one after the other
+	void write_outputs(FILE * out) const {
+		for (const BatchRun & run : runs)
+			fwrite(run.output.data(), 1, run.output.size(), out);
+	}
+
+	// what run k printed to <directory>/job-<k + 1>.txt
+	bool write_outputs(const std::string & directory) const {
+		for (size_t k = 0; k < runs.size(); k++) {
+			char name[32];
+			snprintf(name, sizeof(name), "/job-%06zu.txt", k + 1);
+			FILE * out = fopen((directory + name).c_str(), "wb");
+			if (!out)
+				return false;
+			fwrite(runs[k].output.data(), 1, runs[k].output.size(), out);
+			if (fclose(out) != 0)
+				return false;
+		}
+		return true;
+	}
+
+	void print_stats(FILE * out) const {
+		double total = 0;
+		double fastest = runs.empty() ? 0 : runs[0].seconds;
+		double slowest = 0;
+		for (const BatchRun & run : runs) {
+			total += run.seconds;
+			fastest = std::min(fastest, run.seconds);
+			slowest = std::max(slowest, run.seconds);
+		}
+		fprintf(
+			out,
+			"jobs: %zu runs on %zu thread(s) in %.3f s, %.1f runs/s, %.3f s of running (%.2fx), fastest %.2f ms, slowest %.2f ms\n",
+			runs.size(), threads, seconds, seconds > 0 ? runs.size() / seconds : 0,
+			total, seconds > 0 ? total / seconds : 0, fastest * 1e3, slowest * 1e3
+		);
+	}
+};
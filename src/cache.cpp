@@ -0,0 +1,200 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include "pre-parser.cpp"
+
+// program images for --cache. an image is the decoded program as it is in
+// memory: the instructions, the names and the constants. names and
+// constant texts are stored as ranges of the source, so loading an image
+// still maps the source, but nothing has to be parsed or looked up.
+//
+// an image is only used if it was made from the same source (by hash and
+// size) by a build with the same format, so a stale or foreign image is
+// ignored and the program is decoded from the text again.
+//
+// file layout:
+//   ImageHeader
+//   DecodedInstruction[code_size]   before fusing, so --no-fuse still works
+//   ImageString[name_count]
+//   ImageConstant[constant_count]
+
+#define IMAGE_MAGIC "SLVMIMG"
+#define IMAGE_VERSION 1
+
+struct ImageHeader {
+	char magic[8];          // IMAGE_MAGIC, null terminated
+	uint32_t version;       // IMAGE_VERSION
+	uint32_t instruction_count; // I_MAX, opcodes are stored as numbers
+	uint32_t instruction_size;  // sizeof(DecodedInstruction)
+	uint32_t num_size;      // sizeof(num_t)
+	uint64_t source_hash;   // fnv1a of the source
+	uint64_t source_size;
+	uint64_t line_count;
+	uint64_t code_size;
+	uint64_t name_count;
+	uint64_t constant_count;
+};
+
+static_assert(sizeof(ImageHeader) % 8 == 0, "keeps what follows the header aligned");
+
+struct ImageString {
+	uint64_t offset; // in the source
+	uint64_t size;
+};
+
+struct ImageConstant {
+	ImageString text;
+	num_t n;
+	uint32_t is_num;
+};
+
+inline uint64_t fnv1a(const char * data, size_t size) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+// the image to use for a program: prog.slvm.txt -> prog.slvmc,
+// anything else gets .slvmc appended
+inline std::string image_path(const std::string & source_path) {
+	const std::string suffix = ".slvm.txt";
+	if (source_path.size() > suffix.size() && source_path.compare(source_path.size() - suffix.size(), suffix.size(), suffix) == 0)
+		return source_path.substr(0, source_path.size() - suffix.size()) + ".slvmc";
+	return source_path + ".slvmc";
+}
+
+inline ImageHeader image_header(InstructionStorage & store) {
+	ImageHeader header = {};
+	strcpy(header.magic, IMAGE_MAGIC);
+	header.version = IMAGE_VERSION;
+	header.instruction_count = I_MAX;
+	header.instruction_size = sizeof(DecodedInstruction);
+	header.num_size = sizeof(num_t);
+	header.source_hash = fnv1a(store.source.data, store.source.size);
+	header.source_size = store.source.size;
+	header.line_count = store.size;
+	return header;
+}
+
+// writes the decoded program, which must not have been fused yet.
+// the image is written next to its final name and renamed, so a program
+// started at the same time never sees half of it
+inline bool save_image(InstructionStorage & store, const std::string & path) {
+	ImageHeader header = image_header(store);
+	header.code_size = store.code_size;
+	header.name_count = store.names.size();
+	header.constant_count = store.constants.size();
+
+	std::string temp = path + ".tmp";
+	FILE * out = fopen(temp.c_str(), "wb");
+	if (!out)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+	ok = ok && fwrite(store.code, sizeof(DecodedInstruction), store.code_size, out) == store.code_size;
+	for (std::string_view name : store.names) {
+		ImageString s = {(uint64_t)(name.data() - store.source.data), name.size()};
+		ok = ok && fwrite(&s, sizeof(s), 1, out) == 1;
+	}
+	for (Constant & c : store.constants) {
+		ImageConstant ic = {};
+		ic.text = {(uint64_t)(c.text.data() - store.source.data), c.text.size()};
+		ic.n = c.n;
+		ic.is_num = c.is_num;
+		ok = ok && fwrite(&ic, sizeof(ic), 1, out) == 1;
+	}
+	ok = fclose(out) == 0 && ok;
+	if (ok)
+		ok = rename(temp.c_str(), path.c_str()) == 0;
+	if (!ok)
+		remove(temp.c_str());
+	return ok;
+}
+
+// loads the decoded program from an image made from the source that is
+// already in `store`. returns false, leaving `store` undecoded, if there
+// is no usable image
+inline bool load_image(InstructionStorage & store, const std::string & path) {
+	MappedFile & image = store.image;
+	if (!image.map(path.c_str(), true) || image.size < sizeof(ImageHeader)) {
+		image.unmap();
+		return false;
+	}
+	const char * data = (const char *)image.data;
+	ImageHeader header;
+	memcpy(&header, data, sizeof(header));
+	ImageHeader expected = image_header(store);
+	bool ok = memcmp(header.magic, expected.magic, sizeof(header.magic)) == 0
+		&& header.version == expected.version
+		&& header.instruction_count == expected.instruction_count
+		&& header.instruction_size == expected.instruction_size
+		&& header.num_size == expected.num_size
+		&& header.source_hash == expected.source_hash
+		&& header.source_size == expected.source_size
+		&& header.line_count == expected.line_count
+		&& header.code_size > 0 && header.code_size <= header.line_count + 1
+		&& header.name_count <= header.line_count
+		&& header.constant_count <= header.line_count;
+	ok = ok && image.size == sizeof(ImageHeader)
+		+ header.code_size * sizeof(DecodedInstruction)
+		+ header.name_count * sizeof(ImageString)
+		+ header.constant_count * sizeof(ImageConstant);
+	if (!ok) {
+		image.unmap();
+		return false;
+	}
+
+	// the header is a multiple of 8 bytes, so the instructions are aligned
+	DecodedInstruction * code = (DecodedInstruction *)(data + sizeof(ImageHeader));
+	const ImageString * names = (const ImageString *)(code + header.code_size);
+	const ImageConstant * constants = (const ImageConstant *)(names + header.name_count);
+
+	store.names.clear();
+	store.constants.clear();
+	for (size_t i = 0; ok && i < header.name_count; i++) {
+		ok = names[i].offset + names[i].size <= store.source.size;
+		if (ok)
+			store.names.emplace_back(store.source.data + names[i].offset, names[i].size);
+	}
+	for (size_t i = 0; ok && i < header.constant_count; i++) {
+		const ImageString & text = constants[i].text;
+		ok = text.offset + text.size <= store.source.size;
+		if (ok)
+			store.constants.push_back({
+				std::string_view(store.source.data + text.offset, text.size),
+				constants[i].n,
+				constants[i].is_num != 0
+			});
+	}
+	// check every operand, a damaged image must not crash the interpreter
+	for (size_t i = 0; ok && i < header.code_size; i++) {
+		const DecodedInstruction & ins = code[i];
+		ok = ins.op > I_unknown && ins.op < I_MAX && !is_superinstruction(ins.op) && !is_quickened(ins.op)
+			&& ins.line >= 0 && (uint64_t)ins.line <= header.line_count;
+		const char * sig = ok ? instruction_signature[ins.op] : "";
+		for (size_t a = 0; ok && sig[a]; a++) {
+			int32_t arg = ins.args[a];
+			if (sig[a] == 'v')
+				ok = arg >= 0 && (uint64_t)arg < header.name_count;
+			else if (sig[a] == 'l')
+				ok = arg >= 0 && (uint64_t)arg < header.constant_count;
+			else if (sig[a] == 't')
+				ok = arg >= 0 && (uint64_t)arg < header.code_size;
+		}
+	}
+	ok = ok && code[header.code_size - 1].op == I_done;
+	if (!ok) {
+		store.names.clear();
+		store.constants.clear();
+		image.unmap();
+		return false;
+	}
+	store.code = code;
+	store.code_size = header.code_size;
+	return true;
+}
@@ -0,0 +1,332 @@
+#pragma once
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "pre-parser.cpp"
+#include "SLVM.cpp"
+
+// the control flow graph of a decoded program, for --dump-cfg.
+//
+// a basic block ends with a jump, jts, ret, done or an instruction that can
+// stop the program, or right before an instruction that is jumped to. jts
+// has two successors, the subroutine and the instruction after it, where
+// the subroutine returns to. ret has none that are known before running.
+//
+// superinstructions are one instruction here, like they are when running.
+// the instructions they replaced are only part of a block when something
+// jumps right into the middle of them.
+
+enum CfgEdgeKind {
+	EDGE_NEXT,   // falls through
+	EDGE_JUMP,   // a jump that is taken
+	EDGE_CALL,   // jts to the subroutine
+	EDGE_RETURN, // jts to the instruction after it
+};
+
+struct CfgEdge {
+	size_t block;
+	CfgEdgeKind kind;
+};
+
+struct BasicBlock {
+	size_t begin;                     // index of the first instruction
+	size_t end;                       // index after the span of the last one
+	std::vector<size_t> instructions; // superinstructions count once
+	std::vector<CfgEdge> successors;
+	bool reachable;
+	bool loop_header;                 // the target of a jump back into a loop
+	std::vector<int32_t> reads;       // name indices of the variables read
+	std::vector<int32_t> writes;      // and written, both sorted
+};
+
+// whether an instruction is the last of its block
+inline bool instruction_ends_block(Instruction op) {
+	switch (op) {
+		case I_jmp:
+		case I_jt:
+		case I_jf:
+		case I_loadSmallerThanJf:
+		case I_loadLargerThanJf:
+		case I_incJmp:
+		case I_decJmp:
+			return true;
+		default:
+			return instruction_may_stop(op);
+	}
+}
+
+// the operand of an instruction that is a jump target, or -1
+inline int instruction_target_operand(Instruction op) {
+	const char * sig = instruction_signature[op];
+	for (int a = 0; sig[a]; a++)
+		if (sig[a] == 't')
+			return a;
+	return -1;
+}
+
+// whether operand `a` of an instruction, which must name a variable, is
+// written rather than only read. inc and dec do both
+inline bool instruction_writes_operand(Instruction op, int a) {
+	switch (op) {
+		case I_storeAtVar:
+		case I_stackPop:
+		case I_stackPeek:
+		case I_setVarAddress:
+		case I_inc:
+		case I_dec:
+		case I_incJmp:
+		case I_decJmp:
+			return a == 0;
+		case I_ldiStore:
+			return a == 1;
+		case I_loadAddStore:
+		case I_loadSubStore:
+			return a == 2;
+		default:
+			return false;
+	}
+}
+
+inline bool instruction_reads_operand(Instruction op, int a) {
+	switch (op) {
+		case I_inc:
+		case I_dec:
+		case I_incJmp:
+		case I_decJmp:
+			return true;
+		default:
+			return !instruction_writes_operand(op, a);
+	}
+}
+
+struct ControlFlowGraph {
+	std::vector<BasicBlock> blocks;
+	std::vector<int32_t> block_of; // instruction index -> block it starts, -1 elsewhere
+	size_t unreachable_instructions;
+
+	// returns false (after printing why) if the program jumps somewhere it
+	// cannot. decode() already rejects those, this is for code from elsewhere
+	bool build(const InstructionStorage & store) {
+		const DecodedInstruction * code = store.code;
+		size_t size = store.code_size;
+		blocks.clear();
+		block_of.assign(size, -1);
+		unreachable_instructions = 0;
+		if (!size || code[size - 1].op != I_done) {
+			printf("Error: the program does not end with done\n");
+			return false;
+		}
+
+		// where blocks start
+		std::vector<bool> leader(size + 1, false);
+		leader[0] = true;
+		for (size_t i = 0; i < size; i++) {
+			const DecodedInstruction & ins = code[i];
+			int t = instruction_target_operand(ins.op);
+			if (t >= 0) {
+				if (ins.args[t] < 0 || (size_t)ins.args[t] >= size) {
+					printf("Error: bad jump target %d @ %i\n", ins.args[t], ins.line + 1);
+					return false;
+				}
+				leader[ins.args[t]] = true;
+			}
+			if (instruction_ends_block(ins.op))
+				leader[i + fused_length(ins.op)] = true;
+		}
+		// a jump into the middle of a superinstruction runs the rest of the
+		// sequence on its own, after which both ways meet again
+		for (size_t i = 0; i < size; i++) {
+			size_t length = fused_length(code[i].op);
+			for (size_t j = i + 1; j < i + length; j++)
+				if (leader[j])
+					leader[i + length] = true;
+		}
+
+		for (size_t start = 0; start < size; start++) {
+			if (!leader[start])
+				continue;
+			block_of[start] = blocks.size();
+			BasicBlock block = {};
+			block.begin = start;
+			size_t i = start;
+			while (true) {
+				block.instructions.push_back(i);
+				size_t next = i + fused_length(code[i].op);
+				block.end = next;
+				if (instruction_ends_block(code[i].op) || leader[next])
+					break;
+				i = next;
+			}
+			blocks.push_back(block);
+		}
+
+		for (BasicBlock & block : blocks) {
+			size_t last = block.instructions.back();
+			const DecodedInstruction & ins = code[last];
+			int t = instruction_target_operand(ins.op);
+			switch (ins.op) {
+				case I_jmp:
+				case I_incJmp:
+				case I_decJmp:
+					block.successors.push_back({(size_t)block_of[ins.args[t]], EDGE_JUMP});
+					break;
+				case I_jts:
+					block.successors.push_back({(size_t)block_of[ins.args[t]], EDGE_CALL});
+					block.successors.push_back({(size_t)block_of[block.end], EDGE_RETURN});
+					break;
+				case I_ret:
+				case I_done:
+					break;
+				default:
+					if (t >= 0)
+						block.successors.push_back({(size_t)block_of[ins.args[t]], EDGE_JUMP});
+					block.successors.push_back({(size_t)block_of[block.end], EDGE_NEXT});
+					break;
+			}
+			collect_variables(block, code);
+		}
+
+		find_loops();
+		for (BasicBlock & block : blocks)
+			if (!block.reachable)
+				for (size_t i : block.instructions)
+					// the done decode() appends is only there for programs that run off the end
+					unreachable_instructions += (size_t)code[i].line < store.size;
+		return true;
+	}
+
+	void collect_variables(BasicBlock & block, const DecodedInstruction * code) {
+		for (size_t i : block.instructions) {
+			const DecodedInstruction & ins = code[i];
+			const char * sig = instruction_signature[ins.op];
+			for (int a = 0; sig[a]; a++) {
+				if (sig[a] != 'v')
+					continue;
+				if (instruction_reads_operand(ins.op, a))
+					block.reads.push_back(ins.args[a]);
+				if (instruction_writes_operand(ins.op, a))
+					block.writes.push_back(ins.args[a]);
+			}
+		}
+		for (std::vector<int32_t> * names : {&block.reads, &block.writes}) {
+			std::sort(names->begin(), names->end());
+			names->erase(std::unique(names->begin(), names->end()), names->end());
+		}
+	}
+
+	// marks what can be reached from the start, and the loop headers: the
+	// targets of the edges that lead back to a block that is still being
+	// visited. a subroutine that calls itself is not a loop.
+	// iterative, programs can be deep enough to overflow the stack
+	void find_loops() {
+		enum { WHITE, GREY, BLACK };
+		std::vector<uint8_t> colour(blocks.size(), WHITE);
+		std::vector<std::pair<size_t, size_t>> stack; // block, next successor
+		stack.push_back({0, 0});
+		colour[0] = GREY;
+		blocks[0].reachable = true;
+		while (!stack.empty()) {
+			auto & top = stack.back();
+			BasicBlock & block = blocks[top.first];
+			if (top.second == block.successors.size()) {
+				colour[top.first] = BLACK;
+				stack.pop_back();
+				continue;
+			}
+			CfgEdge edge = block.successors[top.second++];
+			if (colour[edge.block] == GREY && edge.kind != EDGE_CALL)
+				blocks[edge.block].loop_header = true;
+			if (colour[edge.block] == WHITE) {
+				colour[edge.block] = GREY;
+				blocks[edge.block].reachable = true;
+				stack.push_back({edge.block, 0});
+			}
+		}
+	}
+
+	size_t loop_headers() const {
+		size_t n = 0;
+		for (const BasicBlock & block : blocks)
+			n += block.loop_header;
+		return n;
+	}
+
+	// the graph in the DOT format of graphviz. every block lists its
+	// instructions, loop headers have a double border and blocks that
+	// cannot be reached are grey
+	void write_dot(FILE * out, const InstructionStorage & store) const {
+		fprintf(out, "digraph cfg {\n");
+		fprintf(out, "\tnode [shape=box, fontname=\"monospace\"];\n");
+		for (size_t b = 0; b < blocks.size(); b++) {
+			const BasicBlock & block = blocks[b];
+			const DecodedInstruction * code = store.code;
+			std::string label = "B" + std::to_string(b);
+			label += " @ " + std::to_string(code[block.begin].line + 1);
+			if (block.loop_header)
+				label += ", loop";
+			if (!block.reachable)
+				label += ", unreachable";
+			label += "\\l";
+			for (size_t i : block.instructions)
+				label += dot_escape(instruction_text(store, code[i])) + "\\l";
+			if (!block.reads.empty())
+				label += "reads:" + dot_escape(name_list(store, block.reads)) + "\\l";
+			if (!block.writes.empty())
+				label += "writes:" + dot_escape(name_list(store, block.writes)) + "\\l";
+			fprintf(out, "\tb%zu [label=\"%s\"", b, label.c_str());
+			if (block.loop_header)
+				fprintf(out, ", peripheries=2");
+			if (!block.reachable)
+				fprintf(out, ", color=grey, fontcolor=grey");
+			fprintf(out, "];\n");
+		}
+		static const char * edge_style[] = {
+			"",
+			" [label=\"jump\"]",
+			" [label=\"call\", style=dashed]",
+			" [label=\"return\", style=dotted]",
+		};
+		for (size_t b = 0; b < blocks.size(); b++)
+			for (const CfgEdge & edge : blocks[b].successors)
+				fprintf(out, "\tb%zu -> b%zu%s;\n", b, edge.block, edge_style[edge.kind]);
+		fprintf(out, "}\n");
+	}
+
+	// an instruction as it would be written, with jump targets as blocks
+	std::string instruction_text(const InstructionStorage & store, const DecodedInstruction & ins) const {
+		std::string text = instruction_name(ins.op);
+		const char * sig = instruction_signature[ins.op];
+		for (int a = 0; sig[a]; a++) {
+			text += ' ';
+			if (sig[a] == 'v')
+				text += store.names[ins.args[a]];
+			else if (sig[a] == 'l')
+				text += store.constants[ins.args[a]].text;
+			else if (sig[a] == 't')
+				text += "B" + std::to_string(block_of[ins.args[a]]);
+			else
+				text += std::to_string(ins.args[a]);
+		}
+		return text;
+	}
+
+	static std::string name_list(const InstructionStorage & store, const std::vector<int32_t> & names) {
+		std::string list;
+		for (int32_t n : names) {
+			list += ' ';
+			list += store.names[n];
+		}
+		return list;
+	}
+
+	static std::string dot_escape(const std::string & s) {
+		std::string escaped;
+		for (char c : s) {
+			if (c == '"' || c == '\\')
+				escaped += '\\';
+			escaped += (unsigned char)c < 0x20 ? '?' : c;
+		}
+		return escaped;
+	}
+};
@@ -0,0 +1,182 @@
+#ifndef CSLVM_H
+#define CSLVM_H
+#include <stddef.h>
+#include <stdint.h>
+
+// the embedding API of CSLVM, built as the cslvm library. a host decodes a
+// program once and runs it in as many states as it likes, a slice at a
+// time, so scripts can be interleaved with the host's own work. a program
+// can be shared by states on different threads; a state must only be used
+// by one thread at a time.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cslvm_program cslvm_program;
+typedef struct cslvm_state cslvm_state;
+
+typedef enum cslvm_stop {
+	CSLVM_PAUSED = 0, // the slice is used up, the program goes on with the next one
+	CSLVM_DONE,       // the program ran done, or off its end
+	CSLVM_ERROR       // the program stopped on an error, which went to the print callback
+} cslvm_stop;
+
+// what the program prints, including error messages
+typedef void (*cslvm_print_fn)(void * user, const char * text, size_t size);
+// the answer to the question of ask, or NULL if there is none. it has to
+// stay valid until the callback is called again or the state is freed
+typedef const char * (*cslvm_ask_fn)(void * user, const char * question, size_t question_size, size_t * answer_size);
+
+// decode a program from a file or from its text. NULL if the program cannot
+// be read, decoded or run by this version; what is wrong is printed to
+// stdout, like CSLVM does
+cslvm_program * cslvm_program_open(const char * path);
+cslvm_program * cslvm_program_from_text(const char * text, size_t size);
+void cslvm_program_free(cslvm_program * program);
+
+// a state that runs `program` from its start. the program has to outlive
+// it. `memory_cells` is the size of the address space, 0 for the default.
+// NULL if the address space cannot be reserved, or the program's
+// variables do not fit into it
+cslvm_state * cslvm_state_new(const cslvm_program * program, int32_t memory_cells);
+void cslvm_state_free(cslvm_state * state);
+
+// run at most `instructions` instructions, or for about `microseconds`.
+// a superinstruction counts as one instruction, see --no-fuse. once the
+// program has stopped, these return why without running anything
+cslvm_stop cslvm_step(cslvm_state * state, uint64_t instructions);
+cslvm_stop cslvm_run_for(cslvm_state * state, uint64_t microseconds);
+// run until the program stops
+cslvm_stop cslvm_run(cslvm_state * state);
+
+// 0 if there is no variable of that name, neither in the program nor set
+// by the host. strings read as numbers like they do in the program
+int cslvm_get_number(cslvm_state * state, const char * name, double * value);
+// copies the text of a variable, numbers included, into `buffer` and null
+// terminates it, cutting it short to fit `capacity`. `*size` is set to the
+// whole length
+int cslvm_get_string(cslvm_state * state, const char * name, char * buffer, size_t capacity, size_t * size);
+// 0 if the variable is new and does not fit into memory
+int cslvm_set_number(cslvm_state * state, const char * name, double value);
+int cslvm_set_string(cslvm_state * state, const char * name, const char * text, size_t size);
+
+// NULL goes back to stdout and stdin
+void cslvm_set_print(cslvm_state * state, cslvm_print_fn print, void * user);
+void cslvm_set_ask(cslvm_state * state, cslvm_ask_fn ask, void * user);
+
+#ifdef __cplusplus
+}
+
+#include <string>
+#include <string_view>
+#include <functional>
+#include <memory>
+
+// the same for C++, owning what they create
+namespace cslvm {
+	struct Program {
+		std::unique_ptr<cslvm_program, void (*)(cslvm_program *)> handle{NULL, cslvm_program_free};
+
+		static Program open(const std::string & path) {
+			Program p;
+			p.handle.reset(cslvm_program_open(path.c_str()));
+			return p;
+		}
+
+		static Program from_text(std::string_view text) {
+			Program p;
+			p.handle.reset(cslvm_program_from_text(text.data(), text.size()));
+			return p;
+		}
+
+		explicit operator bool() const {
+			return handle != NULL;
+		}
+	};
+
+	struct State {
+		typedef std::function<void (std::string_view)> Print;
+		typedef std::function<bool (std::string_view question, std::string & answer)> Ask;
+
+		// the callbacks are kept apart from the state so they do not move
+		// when it does
+		struct Hooks {
+			Print print;
+			Ask ask;
+			std::string answer;
+		};
+
+		std::unique_ptr<cslvm_state, void (*)(cslvm_state *)> handle{NULL, cslvm_state_free};
+		std::unique_ptr<Hooks> hooks{new Hooks()};
+
+		State() {}
+
+		explicit State(const Program & program, int32_t memory_cells = 0) {
+			handle.reset(cslvm_state_new(program.handle.get(), memory_cells));
+		}
+
+		explicit operator bool() const {
+			return handle != NULL;
+		}
+
+		cslvm_stop step(uint64_t instructions) {
+			return cslvm_step(handle.get(), instructions);
+		}
+
+		cslvm_stop run_for(uint64_t microseconds) {
+			return cslvm_run_for(handle.get(), microseconds);
+		}
+
+		cslvm_stop run() {
+			return cslvm_run(handle.get());
+		}
+
+		bool get_number(const std::string & name, double & value) {
+			return cslvm_get_number(handle.get(), name.c_str(), &value);
+		}
+
+		bool get_string(const std::string & name, std::string & value) {
+			size_t size = 0;
+			if (!cslvm_get_string(handle.get(), name.c_str(), NULL, 0, &size))
+				return false;
+			value.resize(size + 1);
+			cslvm_get_string(handle.get(), name.c_str(), &value[0], value.size(), &size);
+			value.resize(size);
+			return true;
+		}
+
+		bool set_number(const std::string & name, double value) {
+			return cslvm_set_number(handle.get(), name.c_str(), value);
+		}
+
+		bool set_string(const std::string & name, std::string_view value) {
+			return cslvm_set_string(handle.get(), name.c_str(), value.data(), value.size());
+		}
+
+		void on_print(Print print) {
+			hooks->print = std::move(print);
+			cslvm_set_print(handle.get(), hooks->print ? print_trampoline : NULL, hooks.get());
+		}
+
+		void on_ask(Ask ask) {
+			hooks->ask = std::move(ask);
+			cslvm_set_ask(handle.get(), hooks->ask ? ask_trampoline : NULL, hooks.get());
+		}
+
+		static void print_trampoline(void * user, const char * text, size_t size) {
+			((Hooks *)user)->print(std::string_view(text, size));
+		}
+
+		static const char * ask_trampoline(void * user, const char * question, size_t question_size, size_t * answer_size) {
+			Hooks * h = (Hooks *)user;
+			if (!h->ask(std::string_view(question, question_size), h->answer))
+				return NULL;
+			*answer_size = h->answer.size();
+			return h->answer.data();
+		}
+	};
+}
+#endif
+
+#endif
@@ -0,0 +1,1103 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "pre-parser.cpp"
+
+// the graphics instructions go through a ring to a renderer on a thread of
+// its own, so drawing does not hold up the interpreter. graphicsFlip ends
+// a frame and clg starts the next one from the background. the only
+// renderer is headless: it rasterises into an RGBA framebuffer in memory,
+// splitting every frame into tiles that are drawn in parallel, and can
+// write every frame to a file, so graphics programs also run where there
+// is no display (-g).
+//
+// the framebuffer is in pixels, with 0, 0 in the top left corner and y
+// growing downwards. colors are 0xRRGGBB numbers, like createColor makes.
+
+enum GraphicInstructions{
+	GI_P_PX,
+	GI_P_LN,
+	GI_P_REC,
+	GI_P_TXT,
+	GI_GOTO,
+	GI_S_CL,
+	GI_S_SW,
+	GI_FLIP,
+	GI_CLEAR
+};
+
+struct GraphicInstruction {
+	GraphicInstructions instruction;
+	union Data {
+		struct {
+			num_t x;
+			num_t y;
+		} D_GI_P_PX;
+		struct {
+			num_t x0;
+			num_t y0;
+			num_t x1;
+			num_t y1;
+		} D_GI_P_LN;
+		struct {
+			num_t x;
+			num_t y;
+			num_t w;
+			num_t h;
+		} D_GI_P_REC;
+		struct {
+			uint32_t size;   // the text follows in the next slots of the ring
+			uint32_t offset; // and is then kept by the renderer, see Renderer::frame_text
+			char * heap;     // or is here, if it is too long for the ring
+		} D_GI_P_TXT;
+		struct {
+			num_t x;
+			num_t y;
+		} D_GI_GOTO;
+		struct {
+			num_t cl;
+		} D_GI_S_CL;
+		struct {
+			num_t w;
+		} D_GI_S_SW;
+	} data;
+};
+
+// coordinates are clamped to this, far enough outside any framebuffer that
+// clamping does not change what is drawn, and close enough that sums of
+// them do not overflow an int
+const int PIXEL_LIMIT = 1 << 24;
+const int MAX_STROKE_WIDTH = 1024;
+const int MAX_FRAMEBUFFER_SIZE = 16384;
+const double CLIP_EPSILON = 1.0 / 1024;
+const int TILE_ROWS = 32;
+
+inline int to_pixel(num_t v) {
+	if (!(v >= -PIXEL_LIMIT)) // also NaN
+		return -PIXEL_LIMIT;
+	if (v > PIXEL_LIMIT)
+		return PIXEL_LIMIT;
+	return (int)floor(v);
+}
+
+inline double to_coordinate(num_t v) {
+	if (!(v >= -PIXEL_LIMIT))
+		return -PIXEL_LIMIT;
+	if (v > PIXEL_LIMIT)
+		return PIXEL_LIMIT;
+	return v;
+}
+
+// the framebuffer holds R, G, B, A bytes in that order, whatever the byte
+// order of the machine
+inline uint32_t rgba_pixel(num_t color) {
+	uint32_t c = (uint32_t)(int64_t)to_coordinate(color) & 0xffffff;
+	uint8_t bytes[4] = {uint8_t(c >> 16), uint8_t(c >> 8), uint8_t(c), 255};
+	uint32_t pixel;
+	memcpy(&pixel, bytes, 4);
+	return pixel;
+}
+
+// stores `n` copies of `pixel`, 16 bytes at a time where it can
+inline void fill_span(uint32_t * p, size_t n, uint32_t pixel) {
+#if defined(__SSE2__)
+	while (n && ((uintptr_t)p & 15)) {
+		*p++ = pixel;
+		n--;
+	}
+	__m128i v = _mm_set1_epi32(pixel);
+	for (; n >= 16; n -= 16, p += 16) {
+		_mm_store_si128((__m128i *)p, v);
+		_mm_store_si128((__m128i *)p + 1, v);
+		_mm_store_si128((__m128i *)p + 2, v);
+		_mm_store_si128((__m128i *)p + 3, v);
+	}
+	for (; n >= 4; n -= 4, p += 4)
+		_mm_store_si128((__m128i *)p, v);
+#endif
+	while (n--)
+		*p++ = pixel;
+}
+
+// the columns of the printable ascii characters in a 5x7 font, the lowest
+// bit is the top row
+const uint8_t FONT_5X7[95][5] = {
+	{0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5f, 0x00, 0x00}, {0x00, 0x07, 0x00, 0x07, 0x00}, {0x14, 0x7f, 0x14, 0x7f, 0x14},
+	{0x24, 0x2a, 0x7f, 0x2a, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62}, {0x36, 0x49, 0x55, 0x22, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00},
+	{0x00, 0x1c, 0x22, 0x41, 0x00}, {0x00, 0x41, 0x22, 0x1c, 0x00}, {0x08, 0x2a, 0x1c, 0x2a, 0x08}, {0x08, 0x08, 0x3e, 0x08, 0x08},
+	{0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08}, {0x00, 0x60, 0x60, 0x00, 0x00}, {0x20, 0x10, 0x08, 0x04, 0x02},
+	{0x3e, 0x51, 0x49, 0x45, 0x3e}, {0x00, 0x42, 0x7f, 0x40, 0x00}, {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4b, 0x31},
+	{0x18, 0x14, 0x12, 0x7f, 0x10}, {0x27, 0x45, 0x45, 0x45, 0x39}, {0x3c, 0x4a, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+	{0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1e}, {0x00, 0x36, 0x36, 0x00, 0x00}, {0x00, 0x56, 0x36, 0x00, 0x00},
+	{0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14}, {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06},
+	{0x32, 0x49, 0x79, 0x41, 0x3e}, {0x7e, 0x11, 0x11, 0x11, 0x7e}, {0x7f, 0x49, 0x49, 0x49, 0x36}, {0x3e, 0x41, 0x41, 0x41, 0x22},
+	{0x7f, 0x41, 0x41, 0x22, 0x1c}, {0x7f, 0x49, 0x49, 0x49, 0x41}, {0x7f, 0x09, 0x09, 0x01, 0x01}, {0x3e, 0x41, 0x41, 0x51, 0x32},
+	{0x7f, 0x08, 0x08, 0x08, 0x7f}, {0x00, 0x41, 0x7f, 0x41, 0x00}, {0x20, 0x40, 0x41, 0x3f, 0x01}, {0x7f, 0x08, 0x14, 0x22, 0x41},
+	{0x7f, 0x40, 0x40, 0x40, 0x40}, {0x7f, 0x02, 0x04, 0x02, 0x7f}, {0x7f, 0x04, 0x08, 0x10, 0x7f}, {0x3e, 0x41, 0x41, 0x41, 0x3e},
+	{0x7f, 0x09, 0x09, 0x09, 0x06}, {0x3e, 0x41, 0x51, 0x21, 0x5e}, {0x7f, 0x09, 0x19, 0x29, 0x46}, {0x46, 0x49, 0x49, 0x49, 0x31},
+	{0x01, 0x01, 0x7f, 0x01, 0x01}, {0x3f, 0x40, 0x40, 0x40, 0x3f}, {0x1f, 0x20, 0x40, 0x20, 0x1f}, {0x7f, 0x20, 0x18, 0x20, 0x7f},
+	{0x63, 0x14, 0x08, 0x14, 0x63}, {0x03, 0x04, 0x78, 0x04, 0x03}, {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7f, 0x41, 0x41, 0x00},
+	{0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7f, 0x00}, {0x04, 0x02, 0x01, 0x02, 0x04}, {0x40, 0x40, 0x40, 0x40, 0x40},
+	{0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78}, {0x7f, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20},
+	{0x38, 0x44, 0x44, 0x48, 0x7f}, {0x38, 0x54, 0x54, 0x54, 0x18}, {0x08, 0x7e, 0x09, 0x01, 0x02}, {0x08, 0x14, 0x54, 0x54, 0x3c},
+	{0x7f, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7d, 0x40, 0x00}, {0x20, 0x40, 0x44, 0x3d, 0x00}, {0x00, 0x7f, 0x10, 0x28, 0x44},
+	{0x00, 0x41, 0x7f, 0x40, 0x00}, {0x7c, 0x04, 0x18, 0x04, 0x78}, {0x7c, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38},
+	{0x7c, 0x14, 0x14, 0x14, 0x08}, {0x08, 0x14, 0x14, 0x18, 0x7c}, {0x7c, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+	{0x04, 0x3f, 0x44, 0x40, 0x20}, {0x3c, 0x40, 0x40, 0x20, 0x7c}, {0x1c, 0x20, 0x40, 0x20, 0x1c}, {0x3c, 0x40, 0x30, 0x40, 0x3c},
+	{0x44, 0x28, 0x10, 0x28, 0x44}, {0x0c, 0x50, 0x50, 0x50, 0x3c}, {0x44, 0x64, 0x54, 0x4c, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00},
+	{0x00, 0x00, 0x7f, 0x00, 0x00}, {0x00, 0x41, 0x36, 0x08, 0x00}, {0x08, 0x04, 0x08, 0x10, 0x08},
+};
+const int GLYPH_ADVANCE = 6;
+const int LINE_HEIGHT = 9;
+
+// the pixels, and writing them to files
+struct Framebuffer {
+	int width;
+	int height;
+	uint32_t * pixels; // rows are 16 byte aligned, `stride` pixels apart
+	size_t stride;
+
+	Framebuffer() {
+		width = height = 0;
+		pixels = NULL;
+		stride = 0;
+	}
+
+	~Framebuffer() {
+		free(pixels);
+	}
+
+	Framebuffer(const Framebuffer &) = delete;
+	Framebuffer & operator=(const Framebuffer &) = delete;
+
+	bool init(int w, int h) {
+		if (w < 1 || h < 1 || w > MAX_FRAMEBUFFER_SIZE || h > MAX_FRAMEBUFFER_SIZE)
+			return false;
+		free(pixels);
+		width = w;
+		height = h;
+		stride = (w + 3) & ~3;
+		pixels = (uint32_t *)aligned_alloc(16, stride * h * sizeof(uint32_t));
+		return pixels != NULL;
+	}
+
+	uint32_t * row(int y) {
+		return pixels + stride * y;
+	}
+
+	// binary PPM, which has no alpha
+	bool write_ppm(FILE * out) {
+		fprintf(out, "P6\n%d %d\n255\n", width, height);
+		std::vector<uint8_t> line(width * 3);
+		for (int y = 0; y < height; y++) {
+			const uint8_t * src = (const uint8_t *)row(y);
+			for (int x = 0; x < width; x++) {
+				line[x * 3] = src[x * 4];
+				line[x * 3 + 1] = src[x * 4 + 1];
+				line[x * 3 + 2] = src[x * 4 + 2];
+			}
+			fwrite(line.data(), 1, line.size(), out);
+		}
+		return !ferror(out);
+	}
+
+	// an RGBA PNG. the pixels are stored rather than compressed, which keeps
+	// writing a frame about as fast as copying it
+	bool write_png(FILE * out) {
+		static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+		fwrite(signature, 1, 8, out);
+
+		std::vector<uint8_t> header(13);
+		put_be32(&header[0], width);
+		put_be32(&header[4], height);
+		header[8] = 8;  // bits per channel
+		header[9] = 6;  // RGBA
+		write_chunk(out, "IHDR", header);
+
+		// zlib: a header, stored deflate blocks of at most 65535 bytes, the
+		// adler-32 of the data. every row starts with filter 0, none
+		size_t row_bytes = (size_t)width * 4 + 1;
+		size_t raw_size = row_bytes * height;
+		std::vector<uint8_t> zlib;
+		zlib.reserve(raw_size + raw_size / 65535 * 5 + 16);
+		zlib.push_back(0x78);
+		zlib.push_back(0x01);
+		uint32_t a = 1, b = 0;
+		size_t block_left = 0;
+		size_t written = 0;
+		for (int y = 0; y < height; y++) {
+			const uint8_t * src = (const uint8_t *)row(y);
+			size_t row_at = 0;
+			while (row_at < row_bytes) {
+				if (!block_left) {
+					size_t n = raw_size - written < 65535 ? raw_size - written : 65535;
+					zlib.push_back(written + n == raw_size);
+					zlib.push_back(n & 0xff);
+					zlib.push_back(n >> 8);
+					zlib.push_back(~n & 0xff);
+					zlib.push_back(~n >> 8 & 0xff);
+					block_left = n;
+				}
+				size_t n = row_bytes - row_at < block_left ? row_bytes - row_at : block_left;
+				size_t at = zlib.size();
+				if (row_at == 0) {
+					zlib.push_back(0);
+					zlib.insert(zlib.end(), src, src + n - 1);
+				} else
+					zlib.insert(zlib.end(), src + row_at - 1, src + row_at - 1 + n);
+				// 5552 bytes is the most that can be summed before the
+				// sums could overflow 32 bits
+				for (size_t i = at; i < at + n; i += 5552) {
+					size_t end = i + 5552 < at + n ? i + 5552 : at + n;
+					for (size_t j = i; j < end; j++) {
+						a += zlib[j];
+						b += a;
+					}
+					a %= 65521;
+					b %= 65521;
+				}
+				row_at += n;
+				written += n;
+				block_left -= n;
+			}
+		}
+		zlib.resize(zlib.size() + 4);
+		put_be32(&zlib[zlib.size() - 4], b << 16 | a);
+		write_chunk(out, "IDAT", zlib);
+		write_chunk(out, "IEND", std::vector<uint8_t>());
+		return !ferror(out);
+	}
+
+	static void put_be32(uint8_t * p, uint32_t v) {
+		p[0] = v >> 24;
+		p[1] = v >> 16;
+		p[2] = v >> 8;
+		p[3] = v;
+	}
+
+	static void write_chunk(FILE * out, const char * type, const std::vector<uint8_t> & data) {
+		static uint32_t crc_table[256];
+		if (!crc_table[1])
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++)
+					c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+				crc_table[n] = c;
+			}
+		uint8_t bytes[4];
+		put_be32(bytes, data.size());
+		fwrite(bytes, 1, 4, out);
+		fwrite(type, 1, 4, out);
+		if (!data.empty())
+			fwrite(data.data(), 1, data.size(), out);
+		uint32_t crc = 0xffffffff;
+		for (int i = 0; i < 4; i++)
+			crc = crc_table[(crc ^ (uint8_t)type[i]) & 0xff] ^ (crc >> 8);
+		for (uint8_t byte : data)
+			crc = crc_table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+		put_be32(bytes, crc ^ 0xffffffff);
+		fwrite(bytes, 1, 4, out);
+	}
+};
+
+// what the instructions that do not draw change: the color, the stroke
+// width and where text goes
+struct Pen {
+	uint32_t color;
+	int stroke_width;
+	int cursor_x;
+	int cursor_y;
+
+	Pen() {
+		color = rgba_pixel(0);
+		stroke_width = 1;
+		cursor_x = cursor_y = 0;
+	}
+
+	// returns false if `gi` draws something instead
+	bool apply(const GraphicInstruction & gi) {
+		switch (gi.instruction) {
+			case GI_GOTO:
+				cursor_x = to_pixel(gi.data.D_GI_GOTO.x);
+				cursor_y = to_pixel(gi.data.D_GI_GOTO.y);
+				return true;
+			case GI_S_CL:
+				color = rgba_pixel(gi.data.D_GI_S_CL.cl);
+				return true;
+			case GI_S_SW: {
+				int w = to_pixel(gi.data.D_GI_S_SW.w);
+				stroke_width = w < 1 ? 1 : w > MAX_STROKE_WIDTH ? MAX_STROKE_WIDTH : w;
+				return true;
+			}
+			default:
+				return false;
+		}
+	}
+};
+
+inline int64_t floor_div(int64_t a, int64_t b) {
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+inline int64_t ceil_div(int64_t a, int64_t b) {
+	return -floor_div(-a, b);
+}
+
+// the pixels of a line: one per step along its longer axis, n steps, with
+// the shorter axis moving by i * m / n rounded at step i. unlike the
+// running error of bresenham, that can be worked out for any step, so a
+// tile can start drawing right where the line enters it, and every tile
+// draws the same pixels the whole line would.
+struct LineSteps {
+	int x0;
+	int y0;
+	int sx;
+	int sy;
+	bool steep;    // y is the longer axis
+	int64_t n;
+	int64_t m;
+	int64_t first; // the steps that are drawn
+	int64_t last;
+
+	LineSteps(int ax, int ay, int bx, int by) {
+		x0 = ax;
+		y0 = ay;
+		sx = bx < ax ? -1 : 1;
+		sy = by < ay ? -1 : 1;
+		int64_t dx = bx < ax ? (int64_t)ax - bx : (int64_t)bx - ax;
+		int64_t dy = by < ay ? (int64_t)ay - by : (int64_t)by - ay;
+		steep = dy > dx;
+		n = steep ? dy : dx;
+		m = steep ? dx : dy;
+		first = 0;
+		last = n;
+	}
+
+	// the offsets from `origin` in direction `s` that land in lo..hi
+	static void offsets(int origin, int s, int lo, int hi, int64_t & from, int64_t & to) {
+		if (s > 0) {
+			from = (int64_t)lo - origin;
+			to = (int64_t)hi - origin;
+		} else {
+			from = (int64_t)origin - hi;
+			to = (int64_t)origin - lo;
+		}
+	}
+
+	// only the steps where the longer axis is within lo..hi
+	void restrict_major(int lo, int hi) {
+		int64_t from, to;
+		offsets(steep ? y0 : x0, steep ? sy : sx, lo, hi, from, to);
+		first = std::max(first, from);
+		last = std::min(last, to);
+	}
+
+	// only the steps where the shorter axis is within lo..hi
+	void restrict_minor(int lo, int hi) {
+		int64_t from, to;
+		offsets(steep ? x0 : y0, steep ? sx : sy, lo, hi, from, to);
+		if (m == 0) {
+			if (from > 0 || to < 0)
+				last = first - 1;
+			return;
+		}
+		// floor((2 i m + n) / 2n) is at least `from` and at most `to`
+		first = std::max(first, ceil_div(2 * from * n - n, 2 * m));
+		last = std::min(last, ceil_div(2 * (to + 1) * n - n, 2 * m) - 1);
+	}
+
+	// calls f(x, y) for every step that is drawn
+	template <typename F>
+	void walk(F f) const {
+		if (first > last)
+			return;
+		if (n == 0) {
+			f(x0, y0);
+			return;
+		}
+		int64_t num = 2 * first * m + n;
+		int64_t k = num / (2 * n);
+		int64_t r = num % (2 * n);
+		for (int64_t i = first; i <= last; i++) {
+			if (steep)
+				f(int(x0 + sx * k), int(y0 + sy * i));
+			else
+				f(int(x0 + sx * i), int(y0 + sy * k));
+			r += 2 * m;
+			if (r >= 2 * n) {
+				r -= 2 * n;
+				k++;
+			}
+		}
+	}
+};
+
+// a rectangle of a framebuffer that is drawn to on its own. everything is
+// clipped to it, so the tiles of a frame can be drawn at the same time
+struct Canvas {
+	Framebuffer * framebuffer;
+	int left;
+	int top;
+	int right;  // not included
+	int bottom;
+
+	void clear(uint32_t pixel) {
+		for (int y = top; y < bottom; y++)
+			fill_span(framebuffer->row(y) + left, right - left, pixel);
+	}
+
+	// the rectangle from x, y to x + w, y + h, but not including them
+	void fill_rect(int x, int y, int w, int h, uint32_t pixel) {
+		if (w < 0) {
+			x += w;
+			w = -w;
+		}
+		if (h < 0) {
+			y += h;
+			h = -h;
+		}
+		int x0 = x < left ? left : x;
+		int y0 = y < top ? top : y;
+		int x1 = x + w > right ? right : x + w;
+		int y1 = y + h > bottom ? bottom : y + h;
+		if (x0 >= x1 || y0 >= y1)
+			return;
+		for (int row_y = y0; row_y < y1; row_y++)
+			fill_span(framebuffer->row(row_y) + x0, x1 - x0, pixel);
+	}
+
+	void put_pixel(int x, int y, uint32_t pixel) {
+		if (x >= left && x < right && y >= top && y < bottom)
+			framebuffer->row(y)[x] = pixel;
+	}
+
+	// a round dot `size` pixels across. the pixels whose centres are within
+	// size / 2 of the centre of pixel x, y are painted, or of its top left
+	// corner for even sizes, so that the dot stays symmetric
+	void dot(int x, int y, int size, uint32_t pixel) {
+		if (size <= 1) {
+			put_pixel(x, y, pixel);
+			return;
+		}
+		double cx = x + (size & 1 ? 0.5 : 0.0);
+		double cy = y + (size & 1 ? 0.5 : 0.0);
+		double r2 = size * size / 4.0;
+		int reach = size / 2 + 1;
+		int from = y - reach < top ? top : y - reach;
+		int to = y + reach >= bottom ? bottom - 1 : y + reach;
+		for (int row_y = from; row_y <= to; row_y++) {
+			double dy = row_y + 0.5 - cy;
+			if (dy * dy > r2)
+				continue;
+			double half = sqrt(r2 - dy * dy);
+			int x0 = (int)ceil(cx - half - 0.5);
+			int x1 = (int)floor(cx + half - 0.5);
+			fill_rect(x0, row_y, x1 - x0 + 1, 1, pixel);
+		}
+	}
+
+	// a line `size` pixels wide, with round ends. the line is clipped to the
+	// whole framebuffer rather than to the canvas, so that where it starts
+	// and ends does not depend on the tile
+	void line(double ax, double ay, double bx, double by, int size, uint32_t pixel) {
+		int width = framebuffer->width, height = framebuffer->height;
+		if (size <= 1) {
+			// pixel x covers x up to x + 1, but not x + 1 itself
+			if (Canvas::clip(ax, ay, bx, by, 0, 0, width - CLIP_EPSILON, height - CLIP_EPSILON))
+				thin_line((int)floor(ax), (int)floor(ay), (int)floor(bx), (int)floor(by), pixel);
+			return;
+		}
+		int end_ax = (int)floor(ax), end_ay = (int)floor(ay);
+		int end_bx = (int)floor(bx), end_by = (int)floor(by);
+		double margin = size;
+		if (Canvas::clip(ax, ay, bx, by, -margin, -margin, width + margin, height + margin))
+			thick_line((int)floor(ax), (int)floor(ay), (int)floor(bx), (int)floor(by), size, pixel);
+		dot(end_ax, end_ay, size, pixel);
+		dot(end_bx, end_by, size, pixel);
+	}
+
+	// liang-barsky: cuts the line down to the part inside the box, returns
+	// false if there is none
+	static bool clip(double & ax, double & ay, double & bx, double & by, double left, double top, double right, double bottom) {
+		double dx = bx - ax, dy = by - ay;
+		double t0 = 0, t1 = 1;
+		double p[4] = {-dx, dx, -dy, dy};
+		double q[4] = {ax - left, right - ax, ay - top, bottom - ay};
+		for (int i = 0; i < 4; i++) {
+			if (p[i] == 0) {
+				if (q[i] < 0)
+					return false;
+				continue;
+			}
+			double t = q[i] / p[i];
+			if (p[i] < 0) {
+				if (t > t1)
+					return false;
+				if (t > t0)
+					t0 = t;
+			} else {
+				if (t < t0)
+					return false;
+				if (t < t1)
+					t1 = t;
+			}
+		}
+		bx = ax + t1 * dx;
+		by = ay + t1 * dy;
+		ax = ax + t0 * dx;
+		ay = ay + t0 * dy;
+		return true;
+	}
+
+	// only the steps inside the canvas are walked, so no pixel needs a
+	// bounds check. the inner loop is integer adds on a pointer
+	void thin_line(int x0, int y0, int x1, int y1, uint32_t pixel) {
+		LineSteps steps(x0, y0, x1, y1);
+		steps.restrict_major(steps.steep ? top : left, (steps.steep ? bottom : right) - 1);
+		steps.restrict_minor(steps.steep ? left : top, (steps.steep ? right : bottom) - 1);
+		if (steps.first > steps.last)
+			return;
+		if (steps.n == 0) {
+			framebuffer->row(y0)[x0] = pixel;
+			return;
+		}
+		ptrdiff_t stride = framebuffer->stride;
+		ptrdiff_t major = steps.steep ? steps.sy * stride : steps.sx;
+		ptrdiff_t minor = steps.steep ? steps.sx : steps.sy * stride;
+		int64_t n2 = 2 * steps.n, m2 = 2 * steps.m;
+		int64_t num = steps.first * m2 + steps.n;
+		int64_t k = num / n2;
+		int64_t r = num % n2;
+		int x = int(steps.steep ? x0 + steps.sx * k : x0 + steps.sx * steps.first);
+		int y = int(steps.steep ? y0 + steps.sy * steps.first : y0 + steps.sy * k);
+		uint32_t * p = framebuffer->row(y) + x;
+		for (int64_t i = steps.first; ; i++) {
+			*p = pixel;
+			if (i == steps.last)
+				break;
+			p += major;
+			r += m2;
+			if (r >= n2) {
+				r -= n2;
+				p += minor;
+			}
+		}
+	}
+
+	// a run of pixels across the line at every step, long enough that the
+	// line is `size` pixels wide measured square to it. the runs are
+	// clipped, so the steps may be a little outside the canvas
+	void thick_line(int x0, int y0, int x1, int y1, int size, uint32_t pixel) {
+		LineSteps steps(x0, y0, x1, y1);
+		if (steps.n == 0)
+			return;
+		double length = sqrt((double)steps.n * steps.n + (double)steps.m * steps.m);
+		int run = (int)floor(size * length / steps.n + 0.5);
+		int offset = run / 2;
+		if (steps.steep) {
+			steps.restrict_major(top, bottom - 1);
+			steps.walk([&](int x, int y) { fill_rect(x - offset, y, run, 1, pixel); });
+		} else {
+			steps.restrict_major(left, right - 1);
+			steps.restrict_minor(top + offset - run + 1, bottom - 1 + offset);
+			steps.walk([&](int x, int y) { fill_rect(x, y - offset, 1, run, pixel); });
+		}
+	}
+
+	// text in the 5x7 font with its top left corner at x, y
+	void text(int x, int y, const char * s, size_t size, uint32_t pixel) {
+		int start = x;
+		for (size_t i = 0; i < size; i++) {
+			unsigned char c = s[i];
+			if (c == '\n') {
+				x = start;
+				y += LINE_HEIGHT;
+				continue;
+			}
+			if (c < 0x20 || c > 0x7e)
+				c = '?';
+			if (x > left - GLYPH_ADVANCE && x < right && y > top - LINE_HEIGHT && y < bottom) {
+				const uint8_t * glyph = FONT_5X7[c - 0x20];
+				for (int col = 0; col < 5; col++)
+					for (int bit = 0; bit < 7; bit++)
+						if (glyph[col] >> bit & 1)
+							put_pixel(x + col, y + bit, pixel);
+			}
+			x += GLYPH_ADVANCE;
+		}
+	}
+
+	// draws one instruction of a frame, `text` is the frame's text
+	void draw(const GraphicInstruction & gi, Pen & pen, const char * text) {
+		if (pen.apply(gi))
+			return;
+		switch (gi.instruction) {
+			case GI_P_PX:
+				dot(to_pixel(gi.data.D_GI_P_PX.x), to_pixel(gi.data.D_GI_P_PX.y), pen.stroke_width, pen.color);
+				break;
+			case GI_P_LN:
+				line(
+					to_coordinate(gi.data.D_GI_P_LN.x0), to_coordinate(gi.data.D_GI_P_LN.y0),
+					to_coordinate(gi.data.D_GI_P_LN.x1), to_coordinate(gi.data.D_GI_P_LN.y1),
+					pen.stroke_width, pen.color
+				);
+				break;
+			case GI_P_REC:
+				fill_rect(
+					to_pixel(gi.data.D_GI_P_REC.x), to_pixel(gi.data.D_GI_P_REC.y),
+					to_pixel(gi.data.D_GI_P_REC.w), to_pixel(gi.data.D_GI_P_REC.h),
+					pen.color
+				);
+				break;
+			case GI_P_TXT:
+				this->text(pen.cursor_x, pen.cursor_y, text + gi.data.D_GI_P_TXT.offset, gi.data.D_GI_P_TXT.size, pen.color);
+				break;
+			default:
+				break;
+		}
+	}
+};
+
+// the graphics instructions on their way from the interpreter to the render
+// thread: a bounded ring with one producer and one consumer, so neither
+// side takes a lock. the interpreter only writes `head` and the renderer
+// only writes `tail`. the bytes of a text fill the slots after its
+// instruction. without a renderer nothing is taken out, and a flip or clg
+// simply empties the ring.
+struct GraphicsRing {
+	static constexpr size_t CAPACITY = 1 << 16; // slots, a power of two
+	static constexpr size_t MAX_TEXT = 4096;    // longer text goes on the heap, see push_text
+
+	GraphicInstruction * slots;
+	alignas(64) std::atomic<size_t> head;
+	size_t tail_seen;                  // the interpreter's last look at tail
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) bool has_consumer;
+	std::atomic<bool> closed;
+	uint64_t stalls;                   // times the interpreter waited for room
+	double stall_seconds;
+
+	// the render thread sleeps until it is woken for a frame, or for room
+	std::mutex mutex;
+	std::condition_variable wake;
+	uint64_t wakeups;
+
+	GraphicsRing() {
+		// only the pages that are used get committed
+		slots = new GraphicInstruction[CAPACITY];
+		head = 0;
+		tail = 0;
+		tail_seen = 0;
+		has_consumer = false;
+		closed = false;
+		stalls = 0;
+		stall_seconds = 0;
+		wakeups = 0;
+	}
+
+	~GraphicsRing() {
+		delete[] slots;
+	}
+
+	GraphicsRing(const GraphicsRing &) = delete;
+	GraphicsRing & operator=(const GraphicsRing &) = delete;
+
+	// waits until `n` slots are free
+	void reserve(size_t n) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (CAPACITY - (h - tail_seen) >= n)
+			return;
+		tail_seen = tail.load(std::memory_order_acquire);
+		if (CAPACITY - (h - tail_seen) >= n)
+			return;
+		if (!has_consumer) {
+			drop();
+			return;
+		}
+		auto start = std::chrono::steady_clock::now();
+		stalls++;
+		do {
+			wake_consumer();
+			std::this_thread::yield();
+			tail_seen = tail.load(std::memory_order_acquire);
+		} while (CAPACITY - (h - tail_seen) < n);
+		stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void push(const GraphicInstruction & gi) {
+		reserve(1);
+		size_t h = head.load(std::memory_order_relaxed);
+		slots[h & (CAPACITY - 1)] = gi;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	// drawText. the renderer gets its own copy of the text, so strings are
+	// never shared between threads. text longer than MAX_TEXT would take
+	// up too much of the ring, so it is copied to the heap instead and the
+	// renderer frees it; without a renderer nothing would, or draw it
+	void push_text(const char * text, size_t size) {
+		GraphicInstruction gi;
+		gi.instruction = GI_P_TXT;
+		gi.data.D_GI_P_TXT.size = size;
+		gi.data.D_GI_P_TXT.offset = 0;
+		gi.data.D_GI_P_TXT.heap = NULL;
+		if (size > MAX_TEXT) {
+			if (!has_consumer)
+				return;
+			gi.data.D_GI_P_TXT.heap = new char[size];
+			memcpy(gi.data.D_GI_P_TXT.heap, text, size);
+			push(gi);
+			return;
+		}
+		size_t extra = text_slots(size);
+		reserve(1 + extra);
+		size_t h = head.load(std::memory_order_relaxed);
+		slots[h & (CAPACITY - 1)] = gi;
+		for (size_t i = 0; i < extra; i++) {
+			size_t at = i * sizeof(GraphicInstruction);
+			size_t n = std::min(sizeof(GraphicInstruction), size - at);
+			memcpy(&slots[(h + 1 + i) & (CAPACITY - 1)], text + at, n);
+		}
+		head.store(h + 1 + extra, std::memory_order_release);
+	}
+
+	static size_t text_slots(size_t size) {
+		return (size + sizeof(GraphicInstruction) - 1) / sizeof(GraphicInstruction);
+	}
+
+	// graphicsFlip and clg, in constant time either way
+	void mark(GraphicInstructions marker) {
+		if (!has_consumer) {
+			drop();
+			return;
+		}
+		GraphicInstruction gi;
+		gi.instruction = marker;
+		push(gi);
+		if (marker == GI_FLIP)
+			wake_consumer();
+	}
+
+	// only without a consumer, when the interpreter owns both ends
+	void drop() {
+		tail_seen = head.load(std::memory_order_relaxed);
+		tail.store(tail_seen, std::memory_order_relaxed);
+	}
+
+	void wake_consumer() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			wakeups++;
+		}
+		wake.notify_one();
+	}
+
+	// the consumer waits to be woken, or a few milliseconds at most
+	void wait(uint64_t & seen) {
+		std::unique_lock<std::mutex> lock(mutex);
+		wake.wait_for(lock, std::chrono::milliseconds(5), [&] { return wakeups != seen; });
+		seen = wakeups;
+	}
+
+	// nothing more is pushed
+	void close() {
+		closed.store(true, std::memory_order_release);
+		wake_consumer();
+	}
+};
+
+// runs the tiles of a frame on a few threads, the one asking included
+struct TilePool {
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable start;
+	std::condition_variable done;
+	uint64_t generation;
+	size_t busy;
+	bool stopping;
+	std::atomic<int> next;
+	int count;
+	std::function<void(int)> job;
+
+	TilePool() {
+		generation = 0;
+		busy = 0;
+		stopping = false;
+		next = 0;
+		count = 0;
+	}
+
+	~TilePool() {
+		stop();
+	}
+
+	void begin(int threads) {
+		stopping = false;
+		for (int i = 1; i < threads; i++)
+			workers.emplace_back(&TilePool::worker, this);
+	}
+
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		start.notify_all();
+		for (std::thread & t : workers)
+			t.join();
+		workers.clear();
+	}
+
+	// calls f(0) to f(tiles - 1) and returns when all have returned
+	void run(int tiles, std::function<void(int)> f) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = f;
+			count = tiles;
+			next = 0;
+			busy = workers.size();
+			generation++;
+		}
+		start.notify_all();
+		work();
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [&] { return busy == 0; });
+	}
+
+	void work() {
+		for (int tile = next++; tile < count; tile = next++)
+			job(tile);
+	}
+
+	void worker() {
+		uint64_t seen = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				start.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+			work();
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				busy--;
+			}
+			done.notify_one();
+		}
+	}
+};
+
+enum FrameFormat {
+	FRAMES_NONE,
+	FRAMES_PPM,
+	FRAMES_PNG,
+};
+
+// takes the instructions out of the ring on a thread of its own, collects
+// them into frames and draws every frame in tiles of TILE_ROWS rows
+struct Renderer {
+	Framebuffer framebuffer;
+	uint32_t background;
+	int threads;
+	Pen pen;                                // after everything taken so far
+	Pen frame_pen;                          // when the frame being collected started
+	std::vector<GraphicInstruction> frame;  // what it draws
+	std::string frame_text;                 // and its text
+	bool frame_cleared;                     // it starts from the background
+
+	GraphicsRing * ring;
+	std::thread thread;
+	TilePool pool;
+
+	FrameFormat format;
+	std::string frame_dir;
+	uint64_t frames;
+	double draw_seconds;  // in the rasteriser
+	double write_seconds; // writing frames out
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::time_point last_flip;
+
+	Renderer() {
+		background = rgba_pixel(0xffffff);
+		threads = 1;
+		frame_cleared = false;
+		ring = NULL;
+		format = FRAMES_NONE;
+		frames = 0;
+		draw_seconds = write_seconds = 0;
+	}
+
+	~Renderer() {
+		stop();
+	}
+
+	// returns false if the framebuffer cannot be made. `render_threads` is
+	// how many threads draw, 0 for one per core
+	bool init(int width, int height, int render_threads = 0) {
+		if (!framebuffer.init(width, height))
+			return false;
+		Canvas whole = {&framebuffer, 0, 0, width, height};
+		whole.clear(background);
+		if (render_threads < 1)
+			render_threads = std::max(1u, std::thread::hardware_concurrency());
+		threads = render_threads;
+		return true;
+	}
+
+	// write every frame to `dir`/frame-000001.ppm and so on
+	void dump_frames(const std::string & dir, FrameFormat frame_format) {
+		frame_dir = dir;
+		format = frame_format;
+	}
+
+	// starts drawing what is pushed to `graphics`
+	void start(GraphicsRing * graphics) {
+		ring = graphics;
+		ring->has_consumer = true;
+		started = last_flip = std::chrono::steady_clock::now();
+		pool.begin(threads);
+		thread = std::thread(&Renderer::consume, this);
+	}
+
+	// draws the frames that were flipped and stops. what was drawn after
+	// the last flip is never shown
+	void stop() {
+		if (!thread.joinable())
+			return;
+		ring->close();
+		thread.join();
+		pool.stop();
+		ring->has_consumer = false;
+		ring->drop();
+	}
+
+	void consume() {
+		uint64_t seen = 0;
+		const size_t mask = GraphicsRing::CAPACITY - 1;
+		size_t t = ring->tail.load(std::memory_order_relaxed);
+		while (true) {
+			size_t h = ring->head.load(std::memory_order_acquire);
+			if (t == h) {
+				if (ring->closed.load(std::memory_order_acquire) && ring->head.load(std::memory_order_acquire) == t)
+					return;
+				ring->wait(seen);
+				continue;
+			}
+			while (t != h) {
+				GraphicInstruction gi = ring->slots[t++ & mask];
+				switch (gi.instruction) {
+					case GI_P_TXT: {
+						size_t size = gi.data.D_GI_P_TXT.size;
+						gi.data.D_GI_P_TXT.offset = frame_text.size();
+						if (gi.data.D_GI_P_TXT.heap) {
+							frame_text.append(gi.data.D_GI_P_TXT.heap, size);
+							delete[] gi.data.D_GI_P_TXT.heap;
+							gi.data.D_GI_P_TXT.heap = NULL;
+						} else {
+							for (size_t at = 0; at < size; at += sizeof(GraphicInstruction)) {
+								const char * bytes = (const char *)&ring->slots[t++ & mask];
+								frame_text.append(bytes, std::min(sizeof(GraphicInstruction), size - at));
+							}
+						}
+						frame.push_back(gi);
+						break;
+					}
+					case GI_FLIP:
+						// the frame has its own copy, the ring can take more meanwhile
+						ring->tail.store(t, std::memory_order_release);
+						draw_frame();
+						break;
+					case GI_CLEAR:
+						frame.clear();
+						frame_text.clear();
+						frame_pen = pen;
+						frame_cleared = true;
+						break;
+					default:
+						pen.apply(gi);
+						frame.push_back(gi);
+						break;
+				}
+			}
+			ring->tail.store(t, std::memory_order_release);
+		}
+	}
+
+	void draw_frame() {
+		auto start = std::chrono::steady_clock::now();
+		int tiles = (framebuffer.height + TILE_ROWS - 1) / TILE_ROWS;
+		pool.run(tiles, [this](int tile) { draw_tile(tile); });
+		auto drawn = std::chrono::steady_clock::now();
+		frames++;
+		if (format != FRAMES_NONE)
+			write_frame();
+		frame.clear();
+		frame_text.clear();
+		frame_pen = pen;
+		frame_cleared = false;
+		last_flip = std::chrono::steady_clock::now();
+		draw_seconds += std::chrono::duration<double>(drawn - start).count();
+		write_seconds += std::chrono::duration<double>(last_flip - drawn).count();
+	}
+
+	// every tile goes through all of the frame, each with a pen of its own
+	void draw_tile(int tile) {
+		int top = tile * TILE_ROWS;
+		int bottom = std::min(framebuffer.height, top + TILE_ROWS);
+		Canvas canvas = {&framebuffer, 0, top, framebuffer.width, bottom};
+		if (frame_cleared)
+			canvas.clear(background);
+		Pen tile_pen = frame_pen;
+		for (const GraphicInstruction & gi : frame)
+			canvas.draw(gi, tile_pen, frame_text.data());
+	}
+
+	// a frame that cannot be written is reported, and no more are written
+	void write_frame() {
+		char name[32];
+		snprintf(name, sizeof(name), "/frame-%06llu.%s", (unsigned long long)frames, format == FRAMES_PNG ? "png" : "ppm");
+		std::string path = frame_dir + name;
+		FILE * out = fopen(path.c_str(), "wb");
+		bool ok = out && (format == FRAMES_PNG ? framebuffer.write_png(out) : framebuffer.write_ppm(out));
+		if (out)
+			ok = fclose(out) == 0 && ok;
+		if (!ok) {
+			printf("Warning: could not write %s, no more frames are written\n", path.c_str());
+			format = FRAMES_NONE;
+		}
+	}
+
+	// only once stopped
+	void print_stats(FILE * out) {
+		double seconds = std::chrono::duration<double>(last_flip - started).count();
+		fprintf(
+			out, "graphics: %llu frames of %dx%d drawn by %d thread%s, %.1f frames/s, %.1f frames/s drawing only (%.3f s drawing, %.3f s writing frames)\n",
+			(unsigned long long)frames, framebuffer.width, framebuffer.height, threads, threads == 1 ? "" : "s",
+			seconds > 0 ? frames / seconds : 0.0,
+			draw_seconds > 0 ? frames / draw_seconds : 0.0,
+			draw_seconds, write_seconds
+		);
+		if (ring)
+			fprintf(
+				out, "graphics: the interpreter waited for room in the ring %llu times, %.3f s in total\n",
+				(unsigned long long)ring->stalls, ring->stall_seconds
+			);
+	}
+};
@@ -2,27 +2,71 @@
 #include <map>
 #include <stdio.h>
 #include <cstring>
-#include <fstream>
 #include <vector>
 
 #include "pre-parser.cpp"
 #include "SLVM.cpp"
+#include "sampler.cpp"
+#include "cache.cpp"
+#include "jit.cpp"
+#include "transpile.cpp"
+#include "cfg.cpp"
+#include "batch.cpp"
 
 struct Options{
 	std::string input = "out.slvm.txt";
+	std::string memory = "";
+	std::string trace = "";
+	std::string profile = "";
+	std::string sample = "";
+	std::string emit_cpp = "";
+	std::string dump_cfg = "";
+	std::string size = "480x360";
+	std::string frames = "";
+	std::string frame_format = "ppm";
+	std::string render_threads = "0";
+	std::string jobs = "";
+	std::string job_inputs = "";
+	std::string job_output = "";
+	std::string job_threads = "0";
+	bool profile_cycles = false;
 	bool graphics = false;
 	bool dump = false;
+	bool no_fuse = false;
+	bool stats = false;
+	bool cache = false;
+	bool jit = false;
 
 	std::map<std::string, bool *> flags = {
 		{"g", &graphics},
 		{"--graphics", &graphics},
 		{"d", &dump},
-		{"--dump", &dump}
+		{"--dump", &dump},
+		{"--no-fuse", &no_fuse},
+		{"--stats", &stats},
+		{"--cache", &cache},
+		{"--jit", &jit},
+		{"--profile-cycles", &profile_cycles}
 	};
 
 	std::map<std::string, std::string *> arguments = {
 		{"i", &input},
-		{"--input", &input}
+		{"--input", &input},
+		{"m", &memory},
+		{"--memory", &memory},
+		{"--trace", &trace},
+		{"--profile", &profile},
+		{"--sample", &sample},
+		{"--emit-cpp", &emit_cpp},
+		{"--dump-cfg", &dump_cfg},
+		{"--size", &size},
+		{"--frames", &frames},
+		{"--frame-format", &frame_format},
+		{"--render-threads", &render_threads},
+		{"--jobs", &jobs},
+		{"--job-inputs", &job_inputs},
+		{"--job-output", &job_output},
+		{"--job-threads", &job_threads}
 	};
 
 	std::map<std::string, int *> multi_flags = {};
@@ -74,37 +118,205 @@ Options parse_arguments(int argc, char * argv[]){
 	return options;
 }
 
+int run_batch(Options & options, const InstructionStorage & store, addr_t memory_size) {
+	long long count = 0;
+	if (!options.jobs.empty()) {
+		count = atoll(options.jobs.c_str());
+		if (count < 1) {
+			printf("Invalid number of jobs: %s\n", options.jobs.c_str());
+			return 1;
+		}
+	}
+	if (options.graphics || !options.frames.empty())
+		printf("Warning: graphics are not drawn with --jobs\n");
+	if (!options.trace.empty() || !options.profile.empty() || !options.sample.empty() || options.jit)
+		printf("Warning: --trace, --profile, --sample and --jit are ignored with --jobs\n");
+
+	Batch batch(&store, memory_size, count);
+	if (!options.job_inputs.empty() && !batch.read_inputs(options.job_inputs)) {
+		printf("Could not open file: %s\n", options.job_inputs.c_str());
+		return 1;
+	}
+	batch.run(atoi(options.job_threads.c_str()));
+	if (options.job_output.empty())
+		batch.write_outputs(stdout);
+	else if (!batch.write_outputs(options.job_output)) {
+		printf("Could not write the outputs to %s\n", options.job_output.c_str());
+		return 1;
+	}
+	if (options.stats)
+		batch.print_stats(stderr);
+	return batch.all_loaded() ? 0 : 1;
+}
+
 int main(int argc, char * argv[]){
 	Options options = parse_arguments(argc, argv);
-	// open file
-	std::ifstream file(options.input.c_str());
-	if (!file) {
+	InstructionStorage store;
+	if (!store.open(options.input.c_str())) {
 		printf("Could not open file: %s\n", options.input.c_str());
 		return 1;
 	}
-	// read file
-	std::string line;
-	size_t len = 0;
-	std::vector<std::string> lines;
-	while (std::getline(file, line)) {
-		lines.push_back(line);
+	std::string cache_path = image_path(options.input);
+	if (!options.cache || !load_image(store, cache_path)) {
+		if (!store.decode())
+			return 1;
+		if (options.cache && !save_image(store, cache_path))
+			printf("Warning: could not write %s\n", cache_path.c_str());
 	}
-	// close file
-	file.close();
-	// convert to an array
-	std::string lines_array[lines.size()];
-	for (int i = 0; i < lines.size(); i++) {
-		lines_array[i] = lines[i];
+
+	addr_t memory_size = DEFAULT_MEMORY_SIZE;
+	if (!options.memory.empty()) {
+		long long cells = atoll(options.memory.c_str());
+		if (cells < 1 || cells > INT32_MAX) {
+			printf("Invalid memory size: %s\n", options.memory.c_str());
+			return 1;
+		}
+		memory_size = cells;
+		if (cells > (1 << 24) && sizeof(num_t) == sizeof(float))
+			printf("Warning: addresses above %d cannot be stored exactly in a float\n", 1 << 24);
+	}
+
+	// translate instead of running
+	if (!options.emit_cpp.empty()) {
+		FILE * out = fopen(options.emit_cpp.c_str(), "w");
+		if (!out) {
+			printf("Could not open output file: %s\n", options.emit_cpp.c_str());
+			return 1;
+		}
+		bool ok = emit_cpp(out, store, options.input, memory_size);
+		ok = fclose(out) == 0 && ok;
+		if (!ok) {
+			printf("Could not write %s\n", options.emit_cpp.c_str());
+			return 1;
+		}
+		return 0;
+	}
+
+	if (!options.no_fuse)
+		store.fuse();
+
+	if (!options.dump_cfg.empty()) {
+		ControlFlowGraph cfg;
+		if (!cfg.build(store))
+			return 1;
+		FILE * out = fopen(options.dump_cfg.c_str(), "w");
+		if (!out) {
+			printf("Could not open CFG file: %s\n", options.dump_cfg.c_str());
+			return 1;
+		}
+		cfg.write_dot(out, store);
+		fclose(out);
+		fprintf(
+			stderr, "cfg: %zu blocks, %zu loop headers, %zu unreachable instructions\n",
+			cfg.blocks.size(), cfg.loop_headers(), cfg.unreachable_instructions
+		);
 	}
 
-	InstructionStorage store(lines_array,lines.size());
+	// many runs at once, see batch.cpp
+	if (!options.jobs.empty() || !options.job_inputs.empty())
+		return run_batch(options, store, memory_size);
+
+	// graphics are drawn headless, see graphics.cpp
+	Renderer renderer;
+	if (!options.frames.empty())
+		options.graphics = true;
+	if (options.graphics) {
+		int width = 0, height = 0;
+		char end;
+		int threads = atoi(options.render_threads.c_str());
+		if (sscanf(options.size.c_str(), "%dx%d%c", &width, &height, &end) != 2 || !renderer.init(width, height, threads)) {
+			printf("Invalid graphics size: %s\n", options.size.c_str());
+			return 1;
+		}
+		if (!options.frames.empty()) {
+			if (options.frame_format != "ppm" && options.frame_format != "png") {
+				printf("Unknown frame format: %s\n", options.frame_format.c_str());
+				return 1;
+			}
+			renderer.dump_frames(options.frames, options.frame_format == "png" ? FRAMES_PNG : FRAMES_PPM);
+		}
+	}
 
 	// execute
-	SLVM_state state;
-	while (state.running)
-	{
-		printf("[%s @ %d]\n",store.values[state.instruction_pointer].c_str(),state.instruction_pointer + 1);
-		state.process(store);
+	SLVM_state state(memory_size);
+	if (!state.running)
+		return 1;
+	if (!state.load(store))
+		return 1;
+	if (options.graphics) {
+		state.renderer = &renderer;
+		renderer.start(&state.graphics);
+	}
+#ifdef SLVM_TRACE
+	Tracer tracer;
+	if (!options.trace.empty()) {
+		if (!tracer.start(options.trace.c_str())) {
+			printf("Could not open trace file: %s\n", options.trace.c_str());
+			return 1;
+		}
+		state.tracer = &tracer;
+	}
+#else
+	if (!options.trace.empty())
+		printf("Warning: built without SLVM_TRACE, --trace is ignored\n");
+#endif
+	Profiler profiler;
+	if (!options.profile.empty()) {
+		profiler.init(store.code_size, options.profile_cycles);
+		state.profiler = &profiler;
+	}
+	Sampler sampler;
+	if (!options.sample.empty() && !sampler.start(&state)) {
+		printf("Could not start the sampling profiler\n");
+		return 1;
+	}
+#ifdef SLVM_JIT
+	Jit jit;
+	// the JIT only updates the instruction pointer when it leaves a block,
+	// so samples would all land on a few instructions
+	if (options.jit && (state.profiler || !options.sample.empty() || !options.trace.empty())) {
+		printf("Warning: --jit is ignored while profiling, sampling or tracing\n");
+		options.jit = false;
+	}
+	if (options.jit) {
+		jit.init(&state);
+		jit.run();
+	} else
+		state.run();
+#else
+	if (options.jit)
+		printf("Warning: this build has no JIT, --jit is ignored\n");
+	state.run();
+#endif
+	sampler.stop();
+	renderer.stop();
+#ifdef SLVM_TRACE
+	tracer.stop();
+#endif
+	if (!options.profile.empty()) {
+		FILE * out = fopen(options.profile.c_str(), "w");
+		if (!out) {
+			printf("Could not open profile file: %s\n", options.profile.c_str());
+			return 1;
+		}
+		profiler.report(out, store);
+		fclose(out);
+	}
+	if (!options.sample.empty()) {
+		FILE * out = fopen(options.sample.c_str(), "w");
+		if (!out) {
+			printf("Could not open sample file: %s\n", options.sample.c_str());
+			return 1;
+		}
+		sampler.write_folded(out, store);
+		fclose(out);
+	}
+	if (options.stats) {
+		state.print_stats(stderr);
+#ifdef SLVM_JIT
+		if (options.jit)
+			jit.print_stats(stderr);
+#endif
 	}
 
 
@@ -0,0 +1,765 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+#include <initializer_list>
+
+#include "SLVM.cpp"
+#include "cfg.cpp"
+
+// baseline JIT for --jit. the interpreter counts how often every basic
+// block of the control flow graph is entered, and once a block gets hot it
+// is compiled to x86-64 and run natively from then on. compiled code goes
+// on past the end of its basic block, through branches that are not taken,
+// until it jumps or has to leave.
+//
+// compiled code keeps the accumulator in xmm0 while it is known to be a
+// number, and addresses variables directly, since their slots are resolved
+// when the program is loaded. whatever the JIT does not understand is done
+// by calling the handler of the interpreter. values that are not what the
+// code was compiled for (a string where a number was expected) make the
+// block exit to the interpreter, which then runs that instruction; blocks
+// that keep doing that are thrown away.
+//
+// only for x86-64 with the default cell layout.
+#if defined(__x86_64__) && !defined(SLVM_NAN_BOXING) && defined(SLVM_MMAP)
+#define SLVM_JIT
+#endif
+
+#ifdef SLVM_JIT
+static_assert(sizeof(num_t) == sizeof(float), "the JIT generates single precision code");
+
+// called from compiled code, for everything that needs reference counting
+static float jit_set_num(MemoryCell * cell, float n) {
+	cell->set_num(n);
+	return n;
+}
+
+static void jit_set_constant(MemoryCell * cell, const Constant * c) {
+	cell->set_constant(c);
+}
+
+static void jit_copy(MemoryCell * dst, MemoryCell * src) {
+	dst->copy_from(*src);
+}
+
+enum JitReg {
+	RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+	R8, R9, R10, R11, R12, R13, R14, R15
+};
+
+// condition codes, as used by jcc and setcc
+enum JitCond {
+	CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7,
+	CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF
+};
+
+// just enough of an x86-64 assembler. xmm registers are numbered like the
+// general purpose ones
+struct Assembler {
+	std::vector<uint8_t> out;
+
+	size_t here() {
+		return out.size();
+	}
+
+	void byte(uint8_t b) {
+		out.push_back(b);
+	}
+
+	void bytes(std::initializer_list<uint8_t> bs) {
+		out.insert(out.end(), bs);
+	}
+
+	void dword(uint32_t d) {
+		for (int i = 0; i < 4; i++)
+			byte(d >> (8 * i));
+	}
+
+	void qword(uint64_t q) {
+		dword(q);
+		dword(q >> 32);
+	}
+
+	void rex(bool w, int reg, int rm) {
+		uint8_t r = 0x40 | (w << 3) | ((reg >> 3) << 2) | (rm >> 3);
+		if (r != 0x40)
+			byte(r);
+	}
+
+	// an instruction with a [base + disp32] operand
+	void mem(std::initializer_list<uint8_t> prefix, bool w, std::initializer_list<uint8_t> opcode, int reg, int base, int32_t disp) {
+		bytes(prefix);
+		rex(w, reg, base);
+		bytes(opcode);
+		byte(0x80 | ((reg & 7) << 3) | (base & 7));
+		if ((base & 7) == RSP)
+			byte(0x24);
+		dword(disp);
+	}
+
+	// an instruction with two register operands
+	void rr(std::initializer_list<uint8_t> prefix, bool w, std::initializer_list<uint8_t> opcode, int reg, int rm) {
+		bytes(prefix);
+		rex(w, reg, rm);
+		bytes(opcode);
+		byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+	}
+
+	void movabs(int r, uint64_t imm) {
+		rex(true, 0, r);
+		byte(0xB8 | (r & 7));
+		qword(imm);
+	}
+
+	void mov_imm32(int r, uint32_t imm) {
+		rex(false, 0, r);
+		byte(0xB8 | (r & 7));
+		dword(imm);
+	}
+
+	void call(const void * f) {
+		movabs(RAX, (uint64_t)f);
+		rr({}, false, {0xFF}, 2, RAX);
+	}
+
+	// jumps return where their offset ends, to be patched once the
+	// target is known
+	size_t jcc(int cc) {
+		bytes({0x0F, uint8_t(0x80 | cc)});
+		dword(0);
+		return here();
+	}
+
+	size_t jmp() {
+		byte(0xE9);
+		dword(0);
+		return here();
+	}
+
+	void patch(size_t jump, size_t target) {
+		int32_t rel = (int32_t)(target - jump);
+		memcpy(&out[jump - 4], &rel, 4);
+	}
+
+	void jmp_to(size_t target) {
+		patch(jmp(), target);
+	}
+};
+
+struct JitBlock {
+	void (*entry)();
+	uint32_t entries;
+	uint32_t bails; // exits because a value was not what the code expected
+};
+
+// what the accumulator is, while compiling
+enum JitAccKind {
+	ACC_MEM,   // in state->accumulator, anything
+	ACC_REG,   // a number, in xmm0
+	ACC_CONST, // the constant `c`
+	ACC_VAR    // a copy of the variable at `disp`, not made yet
+};
+
+struct JitAcc {
+	JitAccKind kind;
+	const Constant * c;
+	int32_t disp;
+};
+
+// an exit taken out of the straight line code. the code for it is placed
+// after the block, so the common path does not jump around it
+struct JitExit {
+	enum Kind {
+		EXIT, // go on at ip
+		BAIL, // the interpreter has to run ip
+		LOOP  // back to the top of the block
+	} kind;
+	size_t jump;
+	JitAcc acc;
+	int32_t ip;
+};
+
+struct Jit {
+	static constexpr uint32_t THRESHOLD = 50;     // entries before a block is compiled
+	static constexpr uint32_t BAIL_LIMIT = 64;
+	static constexpr size_t MAX_BLOCK = 512;      // instructions
+	static constexpr size_t CHUNK_SIZE = 1 << 20; // bytes of code memory per mapping
+
+	SLVM_state * state;
+	std::vector<JitBlock *> blocks; // by instruction index
+	std::vector<JitBlock *> owned;
+	std::vector<uint32_t> counts;
+	std::vector<bool> leaders; // where reachable basic blocks start
+	uint32_t epoch;
+
+	std::vector<std::pair<uint8_t *, size_t>> chunks;
+	size_t chunk_used;
+
+	// stats, see print_stats
+	size_t compiled;
+	size_t discarded;
+	size_t flushes;
+	size_t code_bytes;
+
+	Jit() {
+		state = NULL;
+		chunk_used = 0;
+		compiled = 0;
+		discarded = 0;
+		flushes = 0;
+		code_bytes = 0;
+	}
+
+	~Jit() {
+		flush();
+	}
+
+	Jit(const Jit &) = delete;
+	Jit & operator=(const Jit &) = delete;
+
+	// the state has to have its program loaded already
+	void init(SLVM_state * i_state) {
+		state = i_state;
+		const InstructionStorage & store = *state->program;
+		blocks.assign(store.code_size, NULL);
+		counts.assign(store.code_size, 0);
+		// compiled code is entered where the basic blocks of the program
+		// start, see cfg.cpp. decode() already made sure the graph builds
+		leaders.assign(store.code_size, false);
+		ControlFlowGraph cfg;
+		if (cfg.build(store))
+			for (const BasicBlock & block : cfg.blocks)
+				leaders[block.begin] = block.reachable;
+		epoch = state->var_epoch;
+	}
+
+	// drops all compiled code, for when it was compiled with addresses
+	// that are no longer right
+	void flush() {
+		for (JitBlock * block : owned)
+			delete block;
+		owned.clear();
+		std::fill(blocks.begin(), blocks.end(), (JitBlock *)NULL);
+		std::fill(counts.begin(), counts.end(), 0);
+		for (auto & chunk : chunks)
+			munmap(chunk.first, chunk.second);
+		chunks.clear();
+		chunk_used = 0;
+		if (state)
+			epoch = state->var_epoch;
+	}
+
+	void run() {
+		const DecodedInstruction * code = state->code;
+		while (state->running) {
+			if (state->var_epoch != epoch) {
+				flush();
+				flushes++;
+			}
+			addr_t ip = state->instruction_pointer;
+			JitBlock * block = blocks[ip];
+			if (block) {
+				block->entries++;
+				block->entry();
+				if (block->bails > BAIL_LIMIT && block->bails * 2 > block->entries) {
+					// never compiled again, counts[ip] stays at THRESHOLD
+					blocks[ip] = NULL;
+					discarded++;
+				}
+				continue;
+			}
+			if (leaders[ip] && counts[ip] < THRESHOLD && ++counts[ip] == THRESHOLD) {
+				blocks[ip] = compile(ip);
+				if (blocks[ip])
+					continue;
+			}
+			Instructions::func[code[ip].op](state, code[ip]);
+			state->instruction_pointer++;
+		}
+	}
+
+	void print_stats(FILE * out) {
+		fprintf(
+			out,
+			"jit: %zu blocks compiled (%zu bytes), %zu discarded, %zu flushes\n",
+			compiled, code_bytes, discarded, flushes
+		);
+	}
+
+	// copies finished code into executable memory
+	void * install(Assembler & a) {
+		size_t size = a.out.size();
+		if (chunks.empty() || chunk_used + size > chunks.back().second) {
+			size_t bytes = std::max(CHUNK_SIZE, size);
+			void * p = mmap(NULL, bytes, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+				return NULL;
+			chunks.push_back({(uint8_t *)p, bytes});
+			chunk_used = 0;
+		}
+		auto & chunk = chunks.back();
+		// never writable and executable at the same time
+		if (mprotect(chunk.first, chunk.second, PROT_READ | PROT_WRITE) != 0)
+			return NULL;
+		uint8_t * code = chunk.first + chunk_used;
+		memcpy(code, a.out.data(), size);
+		mprotect(chunk.first, chunk.second, PROT_READ | PROT_EXEC);
+		// keep the next block 16 byte aligned
+		chunk_used += (size + 15) & ~(size_t)15;
+		code_bytes += size;
+		return code;
+	}
+
+	JitBlock * compile(int32_t start);
+};
+
+// compiles one block, see Jit::compile
+struct JitCompiler {
+	static constexpr int32_t VALUE = offsetof(MemoryCell, value);
+	static constexpr int32_t TAG = offsetof(MemoryCell, tag);
+
+	SLVM_state * state;
+	const InstructionStorage & store;
+	JitBlock * block;
+	Assembler a;
+	JitAcc acc;
+	std::vector<JitExit> exits;
+	std::vector<size_t> to_epilogue;
+	size_t top;
+	int32_t start;
+	int32_t ip; // the instruction being compiled
+
+	JitCompiler(SLVM_state * i_state, JitBlock * i_block, int32_t i_start)
+		: store(*i_state->program) {
+		state = i_state;
+		block = i_block;
+		start = i_start;
+		acc = {ACC_MEM, NULL, 0};
+	}
+
+	// the displacement of a variable from the memory base in r12, or -1
+	// if it is too far away for a 32 bit displacement
+	int32_t var(int32_t name) {
+		int64_t disp = (int64_t)state->var_addr[name] * sizeof(MemoryCell);
+		return disp >= 0 && disp <= INT32_MAX - 16 ? (int32_t)disp : -1;
+	}
+
+	// whether every variable operand of ins is reachable
+	bool vars_reachable(const DecodedInstruction & ins) {
+		const char * sig = instruction_signature[ins.op];
+		for (size_t i = 0; sig[i]; i++)
+			if (sig[i] == 'v' && var(ins.args[i]) < 0)
+				return false;
+		return true;
+	}
+
+	void exit_later(JitExit::Kind kind, size_t jump, int32_t target) {
+		exits.push_back({kind, jump, acc, target});
+	}
+
+	// xmm = the number in the cell at [base + disp], or bail
+	void load_num(int xmm, int base, int32_t disp) {
+		a.mem({}, false, {0x0F, 0xB6}, RAX, base, disp + TAG);    // movzx eax, byte tag
+		a.rr({}, false, {0x83}, 7, RAX);                           // cmp eax, T_NUM
+		a.byte(MemoryCell::T_NUM);
+		size_t not_num = a.jcc(CC_NE);
+		a.mem({0xF3}, false, {0x0F, 0x10}, xmm, base, disp + VALUE); // movss xmm, value
+		size_t done = a.jmp();
+		a.patch(not_num, a.here());
+		a.rr({}, false, {0x83}, 7, RAX);                           // cmp eax, T_CONST
+		a.byte(MemoryCell::T_CONST);
+		size_t not_const = a.jcc(CC_NE);
+		a.mem({}, true, {0x8B}, RAX, base, disp + VALUE);          // mov rax, value.c
+		a.mem({0xF3}, false, {0x0F, 0x10}, xmm, RAX, offsetof(Constant, n));
+		size_t done_const = a.jmp();
+		a.patch(not_const, a.here());
+		a.rr({}, false, {0x85}, RAX, RAX);                         // test eax, eax (T_UNINIT reads as 0)
+		exit_later(JitExit::BAIL, a.jcc(CC_NE), ip);
+		a.rr({}, false, {0x0F, 0x57}, xmm, xmm);                   // xorps xmm, xmm
+		a.patch(done, a.here());
+		a.patch(done_const, a.here());
+	}
+
+	void load_imm(int xmm, float f) {
+		uint32_t bits;
+		memcpy(&bits, &f, 4);
+		a.mov_imm32(RAX, bits);
+		a.rr({0x66}, false, {0x0F, 0x6E}, xmm, RAX);               // movd xmm, eax
+	}
+
+	// xmm0 = the accumulator as a number. the accumulator itself is unchanged
+	void acc_num() {
+		switch (acc.kind) {
+			case ACC_REG:
+				break;
+			case ACC_CONST:
+				load_imm(0, acc.c->n);
+				break;
+			case ACC_VAR:
+				load_num(0, R12, acc.disp);
+				break;
+			case ACC_MEM:
+				load_num(0, RBX, 0);
+				break;
+		}
+	}
+
+	// stores the accumulator, whatever it is, in state->accumulator
+	void spill(JitAcc & from) {
+		switch (from.kind) {
+			case ACC_MEM:
+				break;
+			case ACC_REG:
+				store_num(RBX, 0, true);
+				break;
+			case ACC_CONST:
+				a.rr({}, true, {0x89}, RBX, RDI);                  // mov rdi, rbx
+				a.movabs(RSI, (uint64_t)from.c);
+				a.call((void *)jit_set_constant);
+				break;
+			case ACC_VAR:
+				a.rr({}, true, {0x89}, RBX, RDI);                  // mov rdi, rbx
+				a.mem({}, true, {0x8D}, RSI, R12, from.disp);      // lea rsi, cell
+				a.call((void *)jit_copy);
+				break;
+		}
+	}
+
+	void spill() {
+		spill(acc);
+		acc = {ACC_MEM, NULL, 0};
+	}
+
+	// the cell at [base + disp] = xmm0. a cell that may hold a string
+	// has to go through set_num, so the string is released
+	void store_num(int base, int32_t disp, bool may_be_string) {
+		size_t slow = 0;
+		if (may_be_string) {
+			a.mem({}, false, {0x80}, 7, base, disp + TAG);         // cmp byte tag, T_STR
+			a.byte(MemoryCell::T_STR);
+			slow = a.jcc(CC_E);
+		}
+		a.mem({0xF3}, false, {0x0F, 0x11}, 0, base, disp + VALUE); // movss value, xmm0
+		a.mem({}, false, {0xC6}, 0, base, disp + TAG);             // mov byte tag, T_NUM
+		a.byte(MemoryCell::T_NUM);
+		if (!may_be_string)
+			return;
+		size_t done = a.jmp();
+		a.patch(slow, a.here());
+		a.mem({}, true, {0x8D}, RDI, base, disp);                  // lea rdi, cell
+		a.call((void *)jit_set_num);                               // keeps xmm0
+		a.patch(done, a.here());
+	}
+
+	// the variable at disp is about to change. if the accumulator is a
+	// copy of it that was not made yet, make it now
+	void before_write(int32_t disp) {
+		if (acc.kind == ACC_VAR && acc.disp == disp)
+			spill();
+	}
+
+	void store_acc(int32_t disp) {
+		switch (acc.kind) {
+			case ACC_REG:
+				store_num(R12, disp, true);
+				break;
+			case ACC_CONST:
+				a.mem({}, true, {0x8D}, RDI, R12, disp);           // lea rdi, cell
+				a.movabs(RSI, (uint64_t)acc.c);
+				a.call((void *)jit_set_constant);
+				break;
+			case ACC_VAR:
+				if (acc.disp == disp)
+					break;
+				a.mem({}, true, {0x8D}, RDI, R12, disp);
+				a.mem({}, true, {0x8D}, RSI, R12, acc.disp);
+				a.call((void *)jit_copy);
+				break;
+			case ACC_MEM:
+				a.mem({}, true, {0x8D}, RDI, R12, disp);
+				a.rr({}, true, {0x89}, RBX, RSI);                  // mov rsi, rbx
+				a.call((void *)jit_copy);
+				break;
+		}
+	}
+
+	void set_ip(int32_t target) {
+		a.movabs(RAX, (uint64_t)&state->instruction_pointer);
+		a.mem({}, false, {0xC7}, 0, RAX, 0);                       // mov dword [rax], target
+		a.dword(target);
+	}
+
+	// leaves the block for target, looping natively if it is the top
+	void jump(int32_t target) {
+		spill();
+		if (target == start) {
+			a.jmp_to(top);
+			return;
+		}
+		set_ip(target);
+		to_epilogue.push_back(a.jmp());
+	}
+
+	// acc = op(acc, var) in single precision
+	void arithmetic(uint8_t opcode, int32_t disp) {
+		acc_num();
+		load_num(1, R12, disp);
+		a.rr({0xF3}, false, {0x0F, opcode}, 0, 1);                 // op xmm0, xmm1
+		acc = {ACC_REG, NULL, 0};
+	}
+
+	// acc = op(addr_t(acc), addr_t(var)), the way the interpreter does it
+	void integer(Instruction op, int32_t disp) {
+		acc_num();
+		load_num(1, R12, disp);
+		a.rr({0xF3}, false, {0x0F, 0x2C}, RAX, 0);                 // cvttss2si eax, xmm0
+		a.rr({0xF3}, false, {0x0F, 0x2C}, RCX, 1);                 // cvttss2si ecx, xmm1
+		compare_or_combine(op);
+		a.rr({0xF3}, false, {0x0F, 0x2A}, 0, RAX);                 // cvtsi2ss xmm0, eax
+		acc = {ACC_REG, NULL, 0};
+	}
+
+	// eax = eax op ecx
+	void compare_or_combine(Instruction op) {
+		auto setcc = [this](int cc) {
+			a.rr({}, false, {0x0F, uint8_t(0x90 | cc)}, 0, RAX);   // setcc al
+			a.rr({}, false, {0x0F, 0xB6}, RAX, RAX);               // movzx eax, al
+		};
+		switch (op) {
+			case I_bitwiseLsfWithVar: a.rr({}, false, {0xD3}, 4, RAX); break; // shl eax, cl
+			case I_bitwiseRsfWithVar: a.rr({}, false, {0xD3}, 7, RAX); break; // sar eax, cl
+			case I_bitwiseAndWithVar: a.rr({}, false, {0x21}, RCX, RAX); break;
+			case I_bitwiseOrWithVar:  a.rr({}, false, {0x09}, RCX, RAX); break;
+			case I_modWithVar:
+				a.byte(0x99);                                      // cdq
+				a.rr({}, false, {0xF7}, 7, RCX);                   // idiv ecx
+				a.rr({}, false, {0x89}, RDX, RAX);                 // mov eax, edx
+				break;
+			case I_boolAndWithVar:
+				a.rr({}, false, {0x85}, RAX, RAX);
+				a.rr({}, false, {0x0F, 0x95}, 0, RAX);             // setne al
+				a.rr({}, false, {0x85}, RCX, RCX);
+				a.rr({}, false, {0x0F, 0x95}, 0, RCX);             // setne cl
+				a.rr({}, false, {0x20}, RCX, RAX);                 // and al, cl
+				a.rr({}, false, {0x0F, 0xB6}, RAX, RAX);
+				break;
+			case I_boolOrWithVar:
+				a.rr({}, false, {0x09}, RCX, RAX);                 // or eax, ecx
+				setcc(CC_NE);
+				break;
+			default: {
+				a.rr({}, false, {0x39}, RCX, RAX);                 // cmp eax, ecx
+				int cc =
+					op == I_boolEqualWithVar ? CC_E :
+					op == I_boolNotEqualWithVar ? CC_NE :
+					op == I_largerThanOrEqualWithVar ? CC_GE :
+					op == I_smallerThanOrEqualWithVar ? CC_LE :
+					op == I_smallerThanWithVar ? CC_L : CC_G;
+				setcc(cc);
+			}
+		}
+	}
+
+	// var += delta
+	void increment(int32_t disp, float delta) {
+		before_write(disp);
+		load_num(1, R12, disp);
+		load_imm(2, delta);
+		a.rr({0xF3}, false, {0x0F, 0x58}, 1, 2);                   // addss xmm1, xmm2
+		// the cell held a number, a constant or nothing, never a string
+		a.mem({0xF3}, false, {0x0F, 0x11}, 1, R12, disp + VALUE);
+		a.mem({}, false, {0xC6}, 0, R12, disp + TAG);
+		a.byte(MemoryCell::T_NUM);
+	}
+
+	// leaves for target if the accumulator is (jt) or is not (jf) true
+	void branch(bool if_true, int32_t target) {
+		acc_num();
+		size_t taken;
+		if (if_true) {
+			a.rr({}, false, {0x0F, 0x57}, 1, 1);                   // xorps xmm1, xmm1
+			a.rr({}, false, {0x0F, 0x2E}, 0, 1);                   // ucomiss xmm0, xmm1
+			taken = a.jcc(CC_A);                                   // acc > 0
+		} else {
+			load_imm(1, 1);
+			a.rr({}, false, {0x0F, 0x2E}, 1, 0);                   // ucomiss xmm1, xmm0
+			taken = a.jcc(CC_A);                                   // acc < 1
+		}
+		exit_later(target == start ? JitExit::LOOP : JitExit::EXIT, taken, target);
+	}
+
+	// runs the handler of the interpreter. returns false if the block has
+	// to end after it
+	bool fallback(const DecodedInstruction & ins) {
+		spill();
+		set_ip(ip);
+		a.movabs(RDI, (uint64_t)state);
+		a.movabs(RSI, (uint64_t)&ins);
+		// a quickened instruction may go back to its generic form while
+		// this block lives, the generic handler works either way
+		a.call((void *)Instructions::func[generic_instruction(ins.op)]);
+		// these change the instruction pointer or the variable addresses
+		// the rest of the block was compiled with. a jump that is taken
+		// leaves instruction_pointer one before its target, like jts does
+		if (instruction_writes_ip(ins.op) || ins.op == I_setVarAddress) {
+			step_ip();
+			to_epilogue.push_back(a.jmp());
+			return false;
+		}
+		a.movabs(RAX, (uint64_t)&state->running);
+		a.mem({}, false, {0x80}, 7, RAX, 0);                       // cmp byte running, 0
+		a.byte(0);
+		exit_later(JitExit::EXIT, a.jcc(CC_E), -1);
+		return true;
+	}
+
+	// jumps and branches, fused or not, and jts, ret and done
+	static bool instruction_writes_ip(Instruction op) {
+		return instruction_target_operand(generic_instruction(op)) >= 0 || op == I_ret || op == I_done;
+	}
+
+	// the interpreter would move on to the next instruction now
+	void step_ip() {
+		a.movabs(RAX, (uint64_t)&state->instruction_pointer);
+		a.mem({}, false, {0xFF}, 0, RAX, 0);                       // inc dword [rax]
+	}
+
+	// returns false if the instruction ends the block
+	bool instruction(const DecodedInstruction & ins) {
+		if (!vars_reachable(ins))
+			return fallback(ins);
+		const int32_t * args = ins.args;
+		// quickened instructions compile like the generic ones, which
+		// already check what the cells hold
+		Instruction op = generic_instruction(ins.op);
+		switch (op) {
+			case I_ldi:
+				acc = {ACC_CONST, &store.constants[args[0]], 0};
+				return true;
+			case I_loadAtVar:
+				acc = {ACC_VAR, NULL, var(args[0])};
+				return true;
+			case I_storeAtVar:
+				store_acc(var(args[0]));
+				return true;
+			case I_addWithVar: arithmetic(0x58, var(args[0])); return true;
+			case I_subWithVar: arithmetic(0x5C, var(args[0])); return true;
+			case I_mulWithVar: arithmetic(0x59, var(args[0])); return true;
+			case I_divWithVar: arithmetic(0x5E, var(args[0])); return true;
+			case I_bitwiseLsfWithVar:
+			case I_bitwiseRsfWithVar:
+			case I_bitwiseAndWithVar:
+			case I_bitwiseOrWithVar:
+			case I_modWithVar:
+			case I_boolAndWithVar:
+			case I_boolOrWithVar:
+			case I_boolEqualWithVar:
+			case I_largerThanOrEqualWithVar:
+			case I_smallerThanOrEqualWithVar:
+			case I_boolNotEqualWithVar:
+			case I_smallerThanWithVar:
+			case I_largerThanWithVar:
+				integer(op, var(args[0]));
+				return true;
+			case I_inc: increment(var(args[0]), 1); return true;
+			case I_dec: increment(var(args[0]), -1); return true;
+			case I_jmp:
+				jump(args[0]);
+				return false;
+			case I_jt: branch(true, args[0]); return true;
+			case I_jf: branch(false, args[0]); return true;
+
+			case I_loadAddStore:
+			case I_loadSubStore:
+				acc = {ACC_VAR, NULL, var(args[0])};
+				arithmetic(ins.op == I_loadAddStore ? 0x58 : 0x5C, var(args[1]));
+				store_acc(var(args[2]));
+				return true;
+			case I_ldiStore:
+				acc = {ACC_CONST, &store.constants[args[0]], 0};
+				store_acc(var(args[1]));
+				return true;
+			case I_loadSmallerThanJf:
+			case I_loadLargerThanJf:
+				acc = {ACC_VAR, NULL, var(args[0])};
+				integer(ins.op == I_loadSmallerThanJf ? I_smallerThanWithVar : I_largerThanWithVar, var(args[1]));
+				branch(false, args[2]);
+				return true;
+			case I_incJmp:
+			case I_decJmp:
+				increment(var(args[0]), ins.op == I_incJmp ? 1 : -1);
+				jump(args[1]);
+				return false;
+
+			default:
+				return fallback(ins);
+		}
+	}
+
+	JitBlock * compile() {
+		a.byte(0x53);                                              // push rbx
+		a.bytes({0x41, 0x54});                                     // push r12
+		a.bytes({0x48, 0x83, 0xEC, 0x08});                         // sub rsp, 8
+		a.movabs(RBX, (uint64_t)&state->accumulator);
+		a.movabs(R12, (uint64_t)state->memory);
+		top = a.here();
+
+		ip = start;
+		for (size_t n = 0; ; n++) {
+			if (n == Jit::MAX_BLOCK || (size_t)ip >= store.code_size) {
+				jump(ip);
+				break;
+			}
+			const DecodedInstruction & ins = store.code[ip];
+			int32_t next = ip + fused_length(ins.op);
+			if (!instruction(ins))
+				break;
+			ip = next;
+		}
+
+		for (JitExit & e : exits) {
+			a.patch(e.jump, a.here());
+			if (e.kind == JitExit::BAIL) {
+				a.movabs(RAX, (uint64_t)&block->bails);
+				a.mem({}, false, {0xFF}, 0, RAX, 0);               // inc dword [rax]
+			}
+			spill(e.acc);
+			if (e.kind == JitExit::LOOP) {
+				a.jmp_to(top);
+				continue;
+			}
+			if (e.ip < 0)
+				step_ip(); // the program stopped in a handler
+			else
+				set_ip(e.ip);
+			to_epilogue.push_back(a.jmp());
+		}
+
+		size_t epilogue = a.here();
+		for (size_t j : to_epilogue)
+			a.patch(j, epilogue);
+		a.bytes({0x48, 0x83, 0xC4, 0x08});                         // add rsp, 8
+		a.bytes({0x41, 0x5C});                                     // pop r12
+		a.byte(0x5B);                                              // pop rbx
+		a.byte(0xC3);                                              // ret
+		return block;
+	}
+};
+
+JitBlock * Jit::compile(int32_t start) {
+	JitBlock * block = new JitBlock();
+	JitCompiler compiler(state, block, start);
+	compiler.compile();
+	void * code = install(compiler.a);
+	if (!code) {
+		delete block;
+		return NULL;
+	}
+	block->entry = (void (*)())code;
+	owned.push_back(block);
+	compiled++;
+	return block;
+}
+#endif
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <string>
+#include <chrono>
+
+#include "SLVM.cpp"
+#include "cslvm.h"
+
+// the cslvm library, see cslvm.h. the programs and states of the API are
+// the interpreter's own; states quicken a copy of the code, so a program
+// can be run by states on any number of threads.
+
+struct cslvm_program {
+	InstructionStorage store;
+};
+
+struct cslvm_state {
+	SLVM_state vm;
+	cslvm_ask_fn ask;
+	void * ask_user;
+
+	cslvm_state(addr_t memory_size) : vm(memory_size) {
+		ask = NULL;
+		ask_user = NULL;
+	}
+};
+
+// how many instructions run_for runs between looking at the clock
+const uint64_t RUN_FOR_SLICE = 4096;
+
+static cslvm_program * finish_program(cslvm_program * program) {
+	if (!program->store.decode()) {
+		delete program;
+		return NULL;
+	}
+	// checked once here rather than by every state, see SLVM_state::load
+	for (size_t i = 0; i < program->store.code_size; i++) {
+		const DecodedInstruction & ins = program->store.code[i];
+		if (Instructions::func[ins.op] == Instructions::fI_TODO) {
+			printf("Unimplemented instruction %s @ %i\n", instruction_name(ins.op).c_str(), ins.line + 1);
+			delete program;
+			return NULL;
+		}
+	}
+	program->store.fuse();
+	return program;
+}
+
+extern "C" cslvm_program * cslvm_program_open(const char * path) {
+	cslvm_program * program = new cslvm_program();
+	if (!program->store.open(path)) {
+		printf("Could not open file: %s\n", path);
+		delete program;
+		return NULL;
+	}
+	return finish_program(program);
+}
+
+extern "C" cslvm_program * cslvm_program_from_text(const char * text, size_t size) {
+	cslvm_program * program = new cslvm_program();
+	program->store.set_text(std::string(text, size));
+	return finish_program(program);
+}
+
+extern "C" void cslvm_program_free(cslvm_program * program) {
+	delete program;
+}
+
+extern "C" cslvm_state * cslvm_state_new(const cslvm_program * program, int32_t memory_cells) {
+	if (!program || memory_cells < 0)
+		return NULL;
+	cslvm_state * state = new cslvm_state(memory_cells ? memory_cells : DEFAULT_MEMORY_SIZE);
+	// load also fails if the program's variables do not fit into memory
+	if (!state->vm.running || !state->vm.load(program->store, true)) {
+		delete state;
+		return NULL;
+	}
+	return state;
+}
+
+extern "C" void cslvm_state_free(cslvm_state * state) {
+	delete state;
+}
+
+static cslvm_stop stop_reason(const cslvm_state * state) {
+	if (state->vm.running)
+		return CSLVM_PAUSED;
+	return state->vm.finished ? CSLVM_DONE : CSLVM_ERROR;
+}
+
+extern "C" cslvm_stop cslvm_step(cslvm_state * state, uint64_t instructions) {
+	state->vm.run_slice(instructions);
+	return stop_reason(state);
+}
+
+extern "C" cslvm_stop cslvm_run_for(cslvm_state * state, uint64_t microseconds) {
+	auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(microseconds);
+	while (state->vm.running) {
+		state->vm.run_slice(RUN_FOR_SLICE);
+		if (std::chrono::steady_clock::now() >= end)
+			break;
+	}
+	return stop_reason(state);
+}
+
+extern "C" cslvm_stop cslvm_run(cslvm_state * state) {
+	if (state->vm.running)
+		state->vm.run();
+	return stop_reason(state);
+}
+
+extern "C" int cslvm_get_number(cslvm_state * state, const char * name, double * value) {
+	MemoryCell * cell = state->vm.find_var(name);
+	if (!cell)
+		return 0;
+	*value = cell->get_num();
+	return 1;
+}
+
+extern "C" int cslvm_get_string(cslvm_state * state, const char * name, char * buffer, size_t capacity, size_t * size) {
+	MemoryCell * cell = state->vm.find_var(name);
+	if (!cell)
+		return 0;
+	char scratch[NUMBER_TEXT_SIZE];
+	std::string_view text = cell->get_view(scratch);
+	if (size)
+		*size = text.size();
+	if (capacity) {
+		size_t n = std::min(text.size(), capacity - 1);
+		memcpy(buffer, text.data(), n);
+		buffer[n] = '\0';
+	}
+	return 1;
+}
+
+// a variable the host sets that does not fit into memory is not an error
+// of the program, so it goes on
+extern "C" int cslvm_set_number(cslvm_state * state, const char * name, double value) {
+	addr_t addr = state->vm.add_var(name);
+	if (addr < 0)
+		return 0;
+	state->vm.memory[addr].set_num(value);
+	return 1;
+}
+
+extern "C" int cslvm_set_string(cslvm_state * state, const char * name, const char * text, size_t size) {
+	addr_t addr = state->vm.add_var(name);
+	if (addr < 0)
+		return 0;
+	state->vm.memory[addr].set_string(state->vm.strings.create(text, size));
+	return 1;
+}
+
+extern "C" void cslvm_set_print(cslvm_state * state, cslvm_print_fn print, void * user) {
+	// the hooks of the interpreter have the same shape
+	state->vm.output = print;
+	state->vm.output_context = user;
+}
+
+static bool ask_hook(void * context, std::string_view question, std::string & answer) {
+	cslvm_state * state = (cslvm_state *)context;
+	size_t size = 0;
+	const char * text = state->ask(state->ask_user, question.data(), question.size(), &size);
+	if (!text)
+		return false;
+	answer.assign(text, size);
+	return true;
+}
+
+extern "C" void cslvm_set_ask(cslvm_state * state, cslvm_ask_fn ask, void * user) {
+	state->ask = ask;
+	state->ask_user = user;
+	state->vm.input = ask ? ask_hook : NULL;
+	state->vm.input_context = state;
+}
@@ -0,0 +1,176 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <algorithm>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define SLVM_MMAP_FILES
+#endif
+
+// how much work each thread should get before it is worth starting one
+#define PARALLEL_MIN_BYTES 0x100000
+
+// number of threads to split `work` items into, `min_work` items per thread at least
+inline size_t worker_count(size_t work, size_t min_work) {
+	size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+	return std::max<size_t>(1, std::min(hardware, work / min_work));
+}
+
+// runs f(worker, begin, end) over `workers` equal slices of [0, size),
+// the last slice on the calling thread
+template <typename F>
+void parallel_for(size_t size, size_t workers, F f) {
+	std::vector<std::thread> threads;
+	for (size_t w = 0; w + 1 < workers; w++)
+		threads.emplace_back(f, w, size * w / workers, size * (w + 1) / workers);
+	f(workers - 1, size * (workers - 1) / workers, size);
+	for (std::thread & t : threads)
+		t.join();
+}
+
+// a file mapped into memory. private, so writing to a writable mapping
+// only changes the pages that are written, and never the file
+struct MappedFile {
+	void * data;
+	size_t size;
+
+	MappedFile() {
+		data = NULL;
+		size = 0;
+	}
+
+	~MappedFile() {
+		unmap();
+	}
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	// returns false if the file could not be opened or mapped. an empty
+	// file maps to no data
+	bool map(const char * path, bool writable = false) {
+#ifdef SLVM_MMAP_FILES
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		bool ok = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+		size = ok ? st.st_size : 0;
+		if (ok && size > 0) {
+			int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+			void * p = mmap(NULL, size, prot, MAP_PRIVATE, fd, 0);
+			ok = p != MAP_FAILED;
+			data = ok ? p : NULL;
+		}
+		close(fd);
+		if (!ok)
+			size = 0;
+		return ok;
+#else
+		return false;
+#endif
+	}
+
+	void unmap() {
+#ifdef SLVM_MMAP_FILES
+		if (data)
+			munmap(data, size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+};
+
+// the text of a program. files are mapped rather than read, and the lines
+// are views into the mapping, so the source is never copied.
+struct SourceText {
+	const char * data;
+	size_t size;
+	MappedFile file;
+	std::string owned; // the text, if it was not mapped
+
+	std::vector<std::string_view> lines;
+
+	SourceText() {
+		data = NULL;
+		size = 0;
+	}
+
+	SourceText(const SourceText &) = delete;
+	SourceText & operator=(const SourceText &) = delete;
+
+	// returns false if the file could not be read
+	bool open(const char * path) {
+		if (file.map(path)) {
+			data = (const char *)file.data;
+			size = file.size;
+#ifdef SLVM_MMAP_FILES
+			if (data)
+				madvise(file.data, size, MADV_SEQUENTIAL);
+#endif
+			split();
+			return true;
+		}
+		// not a regular file, or no mmap
+		FILE * f = fopen(path, "rb");
+		if (!f)
+			return false;
+		std::string text;
+		char buffer[0x10000];
+		size_t n;
+		while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+			text.append(buffer, n);
+		fclose(f);
+		set(std::move(text));
+		return true;
+	}
+
+	void set(std::string text) {
+		file.unmap();
+		owned = std::move(text);
+		data = owned.data();
+		size = owned.size();
+		split();
+	}
+
+	// one view per line, without the line break. a line break at the very
+	// end does not start another line
+	void split() {
+		lines.clear();
+		size_t workers = worker_count(size, PARALLEL_MIN_BYTES);
+		std::vector<std::vector<std::string_view>> parts(workers);
+		parallel_for(size, workers, [&](size_t w, size_t begin, size_t end) {
+			// a line belongs to the slice it starts in
+			if (begin > 0) {
+				const char * nl = (const char *)memchr(data + begin - 1, '\n', end - begin + 1);
+				begin = nl ? nl - data + 1 : end;
+			}
+			std::vector<std::string_view> & out = parts[w];
+			size_t pos = begin;
+			while (pos < end) {
+				const char * nl = (const char *)memchr(data + pos, '\n', size - pos);
+				size_t stop = nl ? nl - data : size;
+				size_t length = stop - pos;
+				// files written on windows keep the \r
+				if (length && data[stop - 1] == '\r')
+					length--;
+				out.emplace_back(data + pos, length);
+				pos = stop + 1;
+			}
+		});
+		size_t total = 0;
+		for (auto & part : parts)
+			total += part.size();
+		lines.reserve(total);
+		for (auto & part : parts)
+			lines.insert(lines.end(), part.begin(), part.end());
+	}
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define SLVM_MMAP
+#endif
+
+// the memory of the VM. the whole address space is reserved up front, but
+// pages are only committed by the kernel once they are touched, so a big
+// address space costs nothing until it is used. cells are never
+// constructed: a zero filled page has to be a page of unwritten cells.
+template <typename Cell>
+struct VirtualMemory {
+	Cell * cells;
+	size_t size;
+	size_t bytes;
+
+	// returns false if the address space could not be reserved
+	bool reserve(size_t i_size) {
+		size = i_size;
+		bytes = size * sizeof(Cell);
+#ifdef SLVM_MMAP
+		void * p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		cells = p == MAP_FAILED ? NULL : (Cell *)p;
+#else
+		cells = (Cell *)calloc(size, sizeof(Cell));
+#endif
+		return cells != NULL;
+	}
+
+	void release() {
+		if (!cells)
+			return;
+#ifdef SLVM_MMAP
+		munmap(cells, bytes);
+#else
+		free(cells);
+#endif
+		cells = NULL;
+	}
+
+	// number of cells in pages that are actually backed by memory
+	size_t resident_cells() {
+#ifdef SLVM_MMAP
+		size_t page = sysconf(_SC_PAGESIZE);
+		size_t pages = (bytes + page - 1) / page;
+		std::vector<unsigned char> residency(pages);
+		if (mincore(cells, bytes, residency.data()) != 0)
+			return size;
+		size_t resident = 0;
+		for (unsigned char r : residency)
+			resident += r & 1;
+		return std::min(size, resident * page / sizeof(Cell));
+#else
+		return size;
+#endif
+	}
+};
@@ -1,7 +1,21 @@
 #pragma once
 #include <string>
 #include <map>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+#include <unordered_map>
+#include <charconv>
 
+#include "loader.cpp"
+
+// this allows an easy hop to data types with more capacity
+#define num_t float
+#define addr_t int
 
 // using an enum allows the usage of a jump table
 enum Instruction {
@@ -108,10 +122,40 @@ enum Instruction {
 	I_stackSmallerThan,
 	I_stackLargerThan,
 	I_conditionalValueSet,
+	// superinstructions. these never appear in source code, they are
+	// produced by InstructionStorage::fuse() from common sequences
+	I_loadAddStore,       // loadAtVar a; addWithVar b; storeAtVar c
+	I_loadSubStore,       // loadAtVar a; subWithVar b; storeAtVar c
+	I_ldiStore,           // ldi k; storeAtVar a
+	I_loadSmallerThanJf,  // loadAtVar a; smallerThanWithVar b; jf t
+	I_loadLargerThanJf,   // loadAtVar a; largerThanWithVar b; jf t
+	I_incJmp,             // inc a; jmp t
+	I_decJmp,             // dec a; jmp t
+	// quickened instructions. these are not made by fuse() either, an
+	// instruction rewrites itself into one of them while the program runs,
+	// see Instructions::quicken. each one is the instruction it is named
+	// after, for numbers only
+	I_addWithVarNum,
+	I_subWithVarNum,
+	I_mulWithVarNum,
+	I_divWithVarNum,
+	I_bitwiseLsfWithVarNum,
+	I_bitwiseRsfWithVarNum,
+	I_bitwiseAndWithVarNum,
+	I_bitwiseOrWithVarNum,
+	I_modWithVarNum,
+	I_boolAndWithVarNum,
+	I_boolOrWithVarNum,
+	I_boolEqualWithVarNum,
+	I_largerThanOrEqualWithVarNum,
+	I_smallerThanOrEqualWithVarNum,
+	I_boolNotEqualWithVarNum,
+	I_smallerThanWithVarNum,
+	I_largerThanWithVarNum,
 	I_MAX // used to determine the number of instructions. must be last.
 };
 
-std::map<std::string,Instruction> instruction_map = {
+const std::map<std::string,Instruction,std::less<>> instruction_map = {
 	{"ldi",I_ldi},
 	{"loadAtVar",I_loadAtVar},
 	{"storeAtVar",I_storeAtVar},
@@ -217,28 +261,487 @@ std::map<std::string,Instruction> instruction_map = {
 };
 
 
+inline bool is_superinstruction(Instruction i) {
+	return i > I_conditionalValueSet && i <= I_decJmp;
+}
+
+inline bool is_quickened(Instruction i) {
+	return i >= I_addWithVarNum && i < I_MAX;
+}
+
+// the instruction a quickened one stands for, any other stands for itself
+inline Instruction generic_instruction(Instruction i) {
+	static const Instruction generic[] = {
+		I_addWithVar,
+		I_subWithVar,
+		I_mulWithVar,
+		I_divWithVar,
+		I_bitwiseLsfWithVar,
+		I_bitwiseRsfWithVar,
+		I_bitwiseAndWithVar,
+		I_bitwiseOrWithVar,
+		I_modWithVar,
+		I_boolAndWithVar,
+		I_boolOrWithVar,
+		I_boolEqualWithVar,
+		I_largerThanOrEqualWithVar,
+		I_smallerThanOrEqualWithVar,
+		I_boolNotEqualWithVar,
+		I_smallerThanWithVar,
+		I_largerThanWithVar,
+	};
+	if (is_quickened(i))
+		return generic[i - I_addWithVarNum];
+	return i;
+}
+
+// how many instructions of the source a superinstruction stands for
+inline size_t fused_length(Instruction i) {
+	switch (i) {
+		case I_loadAddStore:
+		case I_loadSubStore:
+		case I_loadSmallerThanJf:
+		case I_loadLargerThanJf:
+			return 3;
+		case I_ldiStore:
+		case I_incJmp:
+		case I_decJmp:
+			return 2;
+		default:
+			return 1;
+	}
+}
+
+// the name of an instruction as it is written in the source.
+// superinstructions do not have one, so they get the name of their enum value
+inline std::string instruction_name(Instruction i) {
+	static const char * fused[] = {
+		"loadAddStore",
+		"loadSubStore",
+		"ldiStore",
+		"loadSmallerThanJf",
+		"loadLargerThanJf",
+		"incJmp",
+		"decJmp",
+	};
+	if (is_superinstruction(i))
+		return fused[i - I_conditionalValueSet - 1];
+	if (is_quickened(i))
+		return instruction_name(generic_instruction(i)) + "Num";
+	for (auto & entry : instruction_map)
+		if (entry.second == i)
+			return entry.first;
+	return "unknown";
+}
+
+// operands following each opcode, one character per operand:
+//   v - variable name
+//   t - jump target (index of a line in the source)
+//   l - literal, as used by ldi
+//   i - immediate integer
+const char * instruction_signature[I_MAX] = {
+	"",                          // I_unknown
+	"l",                         // I_ldi
+	"v",                         // I_loadAtVar
+	"v",                         // I_storeAtVar
+	"t",                         // I_jts
+	"",                          // I_ret
+	"v",                         // I_addWithVar
+	"v",                         // I_subWithVar
+	"v",                         // I_mulWithVar
+	"v",                         // I_divWithVar
+	"v",                         // I_bitwiseLsfWithVar
+	"v",                         // I_bitwiseRsfWithVar
+	"v",                         // I_bitwiseAndWithVar
+	"v",                         // I_bitwiseOrWithVar
+	"v",                         // I_modWithVar
+	"",                          // I_print
+	"",                          // I_println
+	"t",                         // I_jmp
+	"t",                         // I_jt
+	"t",                         // I_jf
+	"v",                         // I_boolAndWithVar
+	"v",                         // I_boolOrWithVar
+	"v",                         // I_boolEqualWithVar
+	"v",                         // I_largerThanOrEqualWithVar
+	"v",                         // I_smallerThanOrEqualWithVar
+	"v",                         // I_boolNotEqualWithVar
+	"v",                         // I_smallerThanWithVar
+	"v",                         // I_largerThanWithVar
+	"vv",                        // I_putPixel
+	"vvvv",                      // I_putLine
+	"vvvv",                      // I_putRect
+	"v",                         // I_setColor
+	"",                          // I_clg
+	"",                          // I_done
+	"v",                         // I_malloc
+	"vv",                        // I_round
+	"vv",                        // I_floor
+	"vv",                        // I_ceil
+	"v",                         // I_cos
+	"v",                         // I_sin
+	"v",                         // I_sqrt
+	"vv",                        // I_atan2
+	"",                          // I_mouseDown
+	"",                          // I_mouseX
+	"",                          // I_mouseY
+	"v",                         // I_sleep
+	"v",                         // I_drawText
+	"vv",                        // I_loadAtVarWithOffset
+	"vv",                        // I_storeAtVarWithOffset
+	"v",                         // I_isKeyPressed
+	"vvv",                       // I_createColor
+	"vv",                        // I_charAt
+	"v",                         // I_sizeOf
+	"vv",                        // I_contains
+	"vv",                        // I_join
+	"v",                         // I_setStrokeWidth
+	"v",                         // I_inc
+	"v",                         // I_dec
+	"",                          // I_graphicsFlip
+	"",                          // I_newLine
+	"",                          // I_ask
+	"v",                         // I_setCloudVar
+	"v",                         // I_getCloudVar
+	"vv",                        // I_indexOfChar
+	"vv",                        // I_goto
+	"i",                         // I_imalloc
+	"v",                         // I_getValueAtPointer
+	"v",                         // I_setValueAtPointer
+	"",                          // I_runtimeMillis
+	"vv",                        // I_free
+	"v",                         // I_getVarAddress
+	"v",                         // I_setVarAddress
+	"vv",                        // I_copyVar
+	"",                          // I_incA
+	"",                          // I_decA
+	"v",                         // I_arrayBoundsCheck
+	"",                          // I_getValueAtPointerOfA
+	"",                          // I_stackPushA
+	"",                          // I_stackPopA
+	"v",                         // I_stackPush
+	"v",                         // I_stackPop
+	"",                          // I_stackPeekA
+	"v",                         // I_stackPeek
+	"",                          // I_stackInc
+	"",                          // I_stackDec
+	"",                          // I_stackAdd
+	"",                          // I_stackSub
+	"",                          // I_stackMul
+	"",                          // I_stackDiv
+	"",                          // I_stackBitwiseLsf
+	"",                          // I_stackBitwiseRsf
+	"",                          // I_stackBitwiseAnd
+	"",                          // I_stackBitwiseOr
+	"",                          // I_stackMod
+	"",                          // I_stackBoolAnd
+	"",                          // I_stackBoolOr
+	"",                          // I_stackBoolEqual
+	"",                          // I_stackLargerThanOrEqual
+	"",                          // I_stackSmallerThanOrEqual
+	"",                          // I_stackNotEqual
+	"",                          // I_stackSmallerThan
+	"",                          // I_stackLargerThan
+	"vv",                        // I_conditionalValueSet
+	"vvv",                       // I_loadAddStore
+	"vvv",                       // I_loadSubStore
+	"lv",                        // I_ldiStore
+	"vvt",                       // I_loadSmallerThanJf
+	"vvt",                       // I_loadLargerThanJf
+	"vt",                        // I_incJmp
+	"vt",                        // I_decJmp
+	"v",                         // I_addWithVarNum
+	"v",                         // I_subWithVarNum
+	"v",                         // I_mulWithVarNum
+	"v",                         // I_divWithVarNum
+	"v",                         // I_bitwiseLsfWithVarNum
+	"v",                         // I_bitwiseRsfWithVarNum
+	"v",                         // I_bitwiseAndWithVarNum
+	"v",                         // I_bitwiseOrWithVarNum
+	"v",                         // I_modWithVarNum
+	"v",                         // I_boolAndWithVarNum
+	"v",                         // I_boolOrWithVarNum
+	"v",                         // I_boolEqualWithVarNum
+	"v",                         // I_largerThanOrEqualWithVarNum
+	"v",                         // I_smallerThanOrEqualWithVarNum
+	"v",                         // I_boolNotEqualWithVarNum
+	"v",                         // I_smallerThanWithVarNum
+	"v",                         // I_largerThanWithVarNum
+};
+
+// a single decoded instruction. operands are already parsed, so executing
+// an instruction never has to touch the source text again.
+struct DecodedInstruction {
+	Instruction op;
+	int32_t line;    // index of the opcode in the source, for diagnostics
+	int32_t args[4]; // meaning depends on the operand kind, see instruction_signature:
+	                 //   v - index into InstructionStorage::names
+	                 //   t - index of the target in InstructionStorage::code
+	                 //   l - index into InstructionStorage::constants
+	                 //   i - the value itself
+};
+
+// a literal loaded by ldi. literals that are numbers are parsed once here,
+// so using them as numbers does not go through stof on every use.
+// the text is kept, since printing a constant prints it as it was written
+struct Constant {
+	std::string_view text; // into the source
+	num_t n;               // what the text reads as a number, 0 if it is not one
+	bool is_num;
+};
+
+// a range of instructions decoded by one thread. names and constants are
+// numbered locally, in the order they first appear, and renumbered once
+// all threads are done
+struct DecodeChunk {
+	std::unordered_map<std::string_view, int32_t> name_ids;
+	std::unordered_map<std::string_view, int32_t> constant_ids;
+	std::vector<std::string_view> names;
+	std::vector<Constant> constants;
+};
+
+// instructions each decoding thread should get at least
+#define PARALLEL_MIN_INSTRUCTIONS 0x10000
+
+inline int32_t parse_int(std::string_view text) {
+	int32_t value = 0;
+	std::from_chars(text.data(), text.data() + text.size(), value);
+	return value;
+}
+
 struct InstructionStorage {
-	Instruction * i_codes;
-	std::string * values;
+	SourceText source;
+	const std::string_view * values; // the lines of the source
 	size_t size;
 
-	InstructionStorage(std::string *i_values, size_t i_size){
-		i_codes = new Instruction[i_size];
-		values = new std::string[i_size];
-		size = i_size;
-		for (size_t i = 0; i < size; i++) {
-			values[i] = i_values[i];
-			i_codes[i] = I_unknown;
-		}
+	DecodedInstruction * code;
+	size_t code_size;
+	std::vector<std::string_view> names;
+	std::vector<Constant> constants; // identical literals share one constant
+	MappedFile image; // backs code if the program came from a cache, see cache.cpp
+
+	InstructionStorage() {
+		values = NULL;
+		size = 0;
+		code = NULL;
+		code_size = 0;
+	}
+
+	~InstructionStorage() {
+		if (!image.data)
+			delete[] code;
+	}
+
+	InstructionStorage(const InstructionStorage &) = delete;
+	InstructionStorage & operator=(const InstructionStorage &) = delete;
+
+	// maps the program in, returns false if the file could not be read
+	bool open(const char * path) {
+		if (!source.open(path))
+			return false;
+		values = source.lines.data();
+		size = source.lines.size();
+		return true;
+	}
+
+	void set_text(std::string text) {
+		source.set(std::move(text));
+		values = source.lines.data();
+		size = source.lines.size();
 	}
 
 	size_t get_size(){
-		return size;
+		return code_size;
 	}
 
-	Instruction get_at(size_t i){
-		if(i_codes[i])
-			return i_codes[i];
-		return i_codes[i] = instruction_map[values[i]];
+	// turns the source lines into a contiguous array of DecodedInstructions.
+	// returns false (after printing why) if the program is malformed.
+	//
+	// where an instruction starts depends on the operands of the one
+	// before it, so finding the opcodes is done in one pass. parsing the
+	// operands is the bulk of the work, and on big programs it is split
+	// between threads.
+	bool decode() {
+		std::vector<DecodedInstruction> decoded;
+		// line index -> index in code, -1 for operands
+		std::vector<int32_t> line_to_index(size + 1, -1);
+
+		size_t i = 0;
+		while (i < size) {
+			auto it = instruction_map.find(values[i]);
+			if (it == instruction_map.end()) {
+				printf("Unknown instruction %.*s @ %zu\n", (int)values[i].size(), values[i].data(), i + 1);
+				return false;
+			}
+			DecodedInstruction ins = {};
+			ins.op = it->second;
+			ins.line = i;
+			size_t argc = strlen(instruction_signature[ins.op]);
+			if (i + argc >= size) {
+				printf("Missing operands for %.*s @ %zu\n", (int)values[i].size(), values[i].data(), i + 1);
+				return false;
+			}
+			line_to_index[i] = decoded.size();
+			decoded.push_back(ins);
+			i += argc + 1;
+		}
+		// see the done appended below
+		line_to_index[size] = decoded.size();
+
+		size_t workers = worker_count(decoded.size(), PARALLEL_MIN_INSTRUCTIONS);
+		std::vector<DecodeChunk> chunks(workers);
+		parallel_for(decoded.size(), workers, [&](size_t w, size_t begin, size_t end) {
+			decode_operands(decoded.data() + begin, decoded.data() + end, chunks[w]);
+		});
+
+		// give names and constants their final numbers, in the order the
+		// program first uses them
+		std::unordered_map<std::string_view, int32_t> name_ids;
+		std::unordered_map<std::string_view, int32_t> constant_ids;
+		std::vector<std::vector<int32_t>> name_remap(workers);
+		std::vector<std::vector<int32_t>> constant_remap(workers);
+		for (size_t w = 0; w < workers; w++) {
+			for (std::string_view name : chunks[w].names) {
+				auto id = name_ids.insert({name, (int32_t)names.size()});
+				if (id.second)
+					names.push_back(name);
+				name_remap[w].push_back(id.first->second);
+			}
+			for (Constant & c : chunks[w].constants) {
+				auto id = constant_ids.insert({c.text, (int32_t)constants.size()});
+				if (id.second)
+					constants.push_back(c);
+				constant_remap[w].push_back(id.first->second);
+			}
+		}
+
+		// jump targets are line indices in the source, remap them too
+		// (line, target) of the first bad target each thread found
+		std::vector<std::pair<int32_t, int32_t>> bad_targets(workers, {-1, 0});
+		parallel_for(decoded.size(), workers, [&](size_t w, size_t begin, size_t end) {
+			for (size_t n = begin; n < end; n++) {
+				DecodedInstruction & ins = decoded[n];
+				const char * sig = instruction_signature[ins.op];
+				for (size_t a = 0; sig[a]; a++) {
+					if (sig[a] == 'v')
+						ins.args[a] = name_remap[w][ins.args[a]];
+					else if (sig[a] == 'l')
+						ins.args[a] = constant_remap[w][ins.args[a]];
+					else if (sig[a] == 't') {
+						int32_t target = ins.args[a];
+						if (target < 0 || target > (int32_t)size || line_to_index[target] < 0) {
+							if (bad_targets[w].first < 0)
+								bad_targets[w] = {ins.line, target};
+							continue;
+						}
+						ins.args[a] = line_to_index[target];
+					}
+				}
+			}
+		});
+		for (auto & bad : bad_targets) {
+			if (bad.first >= 0) {
+				printf("Invalid jump target %d @ %d\n", bad.second, bad.first + 1);
+				return false;
+			}
+		}
+
+		// jumping to the end of the program simply ends it. the program is
+		// terminated by a done, so the interpreter never has to check
+		// whether it ran off the end
+		DecodedInstruction end = {};
+		end.op = I_done;
+		end.line = size;
+		decoded.push_back(end);
+
+		code_size = decoded.size();
+		code = new DecodedInstruction[code_size];
+		std::copy(decoded.begin(), decoded.end(), code);
+		return true;
+	}
+
+	void decode_operands(DecodedInstruction * begin, DecodedInstruction * end, DecodeChunk & chunk) {
+		for (DecodedInstruction * ins = begin; ins != end; ins++) {
+			const char * sig = instruction_signature[ins->op];
+			for (size_t a = 0; sig[a]; a++) {
+				std::string_view operand = values[ins->line + 1 + a];
+				switch (sig[a]) {
+					case 'v': {
+						auto id = chunk.name_ids.insert({operand, (int32_t)chunk.names.size()});
+						if (id.second)
+							chunk.names.push_back(operand);
+						ins->args[a] = id.first->second;
+						break;
+					}
+					case 'l': {
+						auto id = chunk.constant_ids.insert({operand, (int32_t)chunk.constants.size()});
+						if (id.second) {
+							// strtof wants a terminated string
+							std::string text(operand);
+							Constant c;
+							c.text = operand;
+							char * end;
+							c.n = strtof(text.c_str(), &end);
+							c.is_num = !text.empty() && *end == '\0';
+							chunk.constants.push_back(c);
+						}
+						ins->args[a] = id.first->second;
+						break;
+					}
+					case 't':
+					case 'i':
+						ins->args[a] = parse_int(operand);
+						break;
+				}
+			}
+		}
+	}
+
+	// replaces common sequences with superinstructions. the fused
+	// instruction takes the place of the first instruction of the sequence
+	// and skips the rest when executed, while the rest stay untouched, so
+	// jumps (and returns) into the middle of a sequence still work.
+	void fuse() {
+		for (size_t i = 0; i + 1 < code_size; i++) {
+			DecodedInstruction * c = code + i;
+			DecodedInstruction fused = {};
+			size_t length = 0;
+
+			if (c[0].op == I_ldi && c[1].op == I_storeAtVar) {
+				fused.op = I_ldiStore;
+				fused.args[0] = c[0].args[0];
+				fused.args[1] = c[1].args[0];
+				length = 2;
+			}
+			else if ((c[0].op == I_inc || c[0].op == I_dec) && c[1].op == I_jmp) {
+				fused.op = c[0].op == I_inc ? I_incJmp : I_decJmp;
+				fused.args[0] = c[0].args[0];
+				fused.args[1] = c[1].args[0];
+				length = 2;
+			}
+			else if (i + 2 < code_size && c[0].op == I_loadAtVar) {
+				if ((c[1].op == I_addWithVar || c[1].op == I_subWithVar) && c[2].op == I_storeAtVar) {
+					fused.op = c[1].op == I_addWithVar ? I_loadAddStore : I_loadSubStore;
+					fused.args[0] = c[0].args[0];
+					fused.args[1] = c[1].args[0];
+					fused.args[2] = c[2].args[0];
+					length = 3;
+				}
+				else if ((c[1].op == I_smallerThanWithVar || c[1].op == I_largerThanWithVar) && c[2].op == I_jf) {
+					fused.op = c[1].op == I_smallerThanWithVar ? I_loadSmallerThanJf : I_loadLargerThanJf;
+					fused.args[0] = c[0].args[0];
+					fused.args[1] = c[1].args[0];
+					fused.args[2] = c[2].args[0];
+					length = 3;
+				}
+			}
+
+			if (!length)
+				continue;
+			fused.line = c[0].line;
+			c[0] = fused;
+			// the remaining instructions of the sequence are left as they were
+			i += length - 1;
+		}
 	}
 };
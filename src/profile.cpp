@@ -0,0 +1,108 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "pre-parser.cpp"
+
+// exact execution counts for --profile: how often every opcode and every
+// instruction ran and, with --profile-cycles, how many cycles each opcode
+// took in total. superinstructions are counted as themselves.
+struct Profiler {
+	std::vector<uint64_t> op_counts;
+	std::vector<uint64_t> op_cycles;
+	std::vector<uint64_t> counts; // per instruction index
+	bool cycles;
+	uint64_t started;
+
+	void init(size_t code_size, bool i_cycles) {
+		op_counts.assign(I_MAX, 0);
+		op_cycles.assign(I_MAX, 0);
+		counts.assign(code_size, 0);
+		cycles = i_cycles;
+		started = 0;
+	}
+
+	// the time stamp counter where there is one, nanoseconds elsewhere
+	static inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()
+		).count();
+#endif
+	}
+
+	inline void enter(addr_t ip, Instruction op) {
+		counts[ip]++;
+		op_counts[op]++;
+		if (cycles)
+			started = now();
+	}
+
+	inline void leave(Instruction op) {
+		if (cycles)
+			op_cycles[op] += now() - started;
+	}
+
+	void report(FILE * out, InstructionStorage & store) {
+		uint64_t total = 0;
+		uint64_t total_cycles = 0;
+		std::vector<int> ops;
+		for (int i = 0; i < I_MAX; i++) {
+			total += op_counts[i];
+			total_cycles += op_cycles[i];
+			if (op_counts[i])
+				ops.push_back(i);
+		}
+		std::sort(ops.begin(), ops.end(), [this](int a, int b) {
+			return op_counts[a] > op_counts[b];
+		});
+
+		fprintf(out, "%llu instructions executed\n\n", (unsigned long long)total);
+		fprintf(out, "%-26s %14s %7s", "instruction", "count", "%");
+		if (cycles)
+			fprintf(out, " %16s %7s %10s", "cycles", "%", "cycles/op");
+		fprintf(out, "\n");
+		for (int i : ops) {
+			fprintf(
+				out, "%-26s %14llu %6.2f%%",
+				instruction_name((Instruction)i).c_str(),
+				(unsigned long long)op_counts[i],
+				100.0 * op_counts[i] / total
+			);
+			if (cycles)
+				fprintf(
+					out, " %16llu %6.2f%% %10.1f",
+					(unsigned long long)op_cycles[i],
+					total_cycles ? 100.0 * op_cycles[i] / total_cycles : 0.0,
+					(double)op_cycles[i] / op_counts[i]
+				);
+			fprintf(out, "\n");
+		}
+
+		// the source, with the number of times each instruction ran
+		fprintf(out, "\n%14s  %6s  source\n", "count", "line");
+		std::vector<int32_t> line_to_index(store.size, -1);
+		for (size_t i = 0; i < store.code_size; i++)
+			if ((size_t)store.code[i].line < store.size)
+				line_to_index[store.code[i].line] = i;
+		for (size_t line = 0; line < store.size; line++) {
+			int32_t i = line_to_index[line];
+			if (i < 0) {
+				// an operand
+				fprintf(out, "%14s  %6zu      %.*s\n", "", line + 1, (int)store.values[line].size(), store.values[line].data());
+				continue;
+			}
+			fprintf(out, "%14llu  %6zu  %.*s", (unsigned long long)counts[i], line + 1, (int)store.values[line].size(), store.values[line].data());
+			if (is_superinstruction(store.code[i].op))
+				fprintf(out, "    (fused into %s)", instruction_name(store.code[i].op).c_str());
+			fprintf(out, "\n");
+		}
+	}
+};
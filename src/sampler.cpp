@@ -0,0 +1,123 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+#include <vector>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "SLVM.cpp"
+
+// sampling profiler for --sample. a SIGPROF timer interrupts the program
+// about a thousand times per second of cpu time, and every time the signal
+// handler copies the instruction pointer and the call stack into a buffer
+// that was allocated up front. after the run the samples are folded into
+// one line per distinct stack, which is the input format of the usual
+// flamegraph tools.
+struct Sampler {
+	static constexpr int INTERVAL_US = 1000;
+	static constexpr size_t MAX_FRAMES = 64;      // innermost frames kept per sample
+	static constexpr size_t BUFFER_WORDS = 1 << 24;
+
+	SLVM_state * state;
+	// every sample is [depth, ip, frame 0 (innermost), frame 1, ...],
+	// with at most MAX_FRAMES frames
+	uint32_t * buffer;
+	volatile size_t used;
+	volatile size_t dropped;
+
+	static inline Sampler * active = NULL; // the signal handler needs to find us
+
+	Sampler() {
+		state = NULL;
+		buffer = NULL;
+		used = 0;
+		dropped = 0;
+	}
+
+	~Sampler() {
+		stop();
+		delete[] buffer;
+	}
+
+	bool start(SLVM_state * i_state) {
+		state = i_state;
+		buffer = new uint32_t[BUFFER_WORDS];
+		active = this;
+
+		struct sigaction action = {};
+		action.sa_handler = on_signal;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGPROF, &action, NULL) != 0)
+			return false;
+
+		struct itimerval timer = {};
+		timer.it_interval.tv_usec = INTERVAL_US;
+		timer.it_value.tv_usec = INTERVAL_US;
+		return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+	}
+
+	void stop() {
+		if (active != this)
+			return;
+		struct itimerval timer = {};
+		setitimer(ITIMER_PROF, &timer, NULL);
+		signal(SIGPROF, SIG_IGN);
+		active = NULL;
+	}
+
+	static void on_signal(int) {
+		Sampler * s = active;
+		if (!s)
+			return;
+		addr_t depth = s->state->call_stack.depth;
+		size_t frames = depth < (addr_t)MAX_FRAMES ? depth : MAX_FRAMES;
+		if (s->used + frames + 2 > BUFFER_WORDS) {
+			s->dropped = s->dropped + 1;
+			return;
+		}
+		uint32_t * sample = s->buffer + s->used;
+		sample[0] = depth;
+		sample[1] = s->state->instruction_pointer;
+		for (size_t i = 0; i < frames; i++)
+			sample[2 + i] = s->state->call_stack.frames[depth - 1 - i];
+		s->used = s->used + frames + 2;
+	}
+
+	// a call is named after the line it jumped to
+	static std::string call_name(InstructionStorage & store, uint32_t return_addr) {
+		if (return_addr >= store.code_size)
+			return "?";
+		const DecodedInstruction & jts = store.code[return_addr];
+		return "line_" + std::to_string(store.code[jts.args[0]].line + 1);
+	}
+
+	// writes one `root;...;leaf count` line per distinct stack
+	void write_folded(FILE * out, InstructionStorage & store) {
+		std::map<std::string, size_t> stacks;
+		size_t i = 0;
+		while (i < used) {
+			uint32_t depth = buffer[i];
+			uint32_t frames = depth < MAX_FRAMES ? depth : MAX_FRAMES;
+			uint32_t ip = buffer[i + 1];
+			const uint32_t * stack = buffer + i + 2;
+			std::string folded = "main";
+			if (depth > frames)
+				folded += ";[truncated]";
+			for (uint32_t f = frames; f > 0; f--)
+				folded += ";" + call_name(store, stack[f - 1]);
+			if (ip < store.code_size) {
+				const DecodedInstruction & ins = store.code[ip];
+				folded += ";" + instruction_name(ins.op) + "@" + std::to_string(ins.line + 1);
+			}
+			stacks[folded]++;
+			i += frames + 2;
+		}
+		for (auto & entry : stacks)
+			fprintf(out, "%s %zu\n", entry.first.c_str(), entry.second);
+		if (dropped)
+			fprintf(stderr, "Warning: %zu samples dropped, the sample buffer was full\n", (size_t)dropped);
+	}
+};
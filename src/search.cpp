@@ -0,0 +1,269 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SLVM_X86_KERNELS
+#endif
+
+// the searches of the string instructions. there is a portable version and,
+// on x86, SSE2 and AVX2 versions that compare 16 or 32 bytes at once. the
+// best one the cpu supports is picked the first time a search runs; set
+// SLVM_STRING_KERNELS to portable, sse2 or avx2 to pick one by hand.
+//
+// substrings are searched like in "SIMD-friendly algorithms for substring
+// searching" by Wojciech Muła: a block of positions is checked for both the
+// first and the last byte of the needle at once, and only the positions
+// where both match are compared in full.
+
+// the index of the first `c` in the `n` bytes at `s`, or -1
+typedef ptrdiff_t (*FindByteKernel)(const char * s, size_t n, char c);
+// the index of the first `needle`, which is at least 2 bytes and no longer
+// than the text, or -1
+typedef ptrdiff_t (*FindKernel)(const char * s, size_t n, const char * needle, size_t m);
+
+struct StringKernels {
+	const char * name;
+	FindByteKernel find_byte;
+	FindKernel find;
+	bool (*supported)();
+};
+
+inline ptrdiff_t find_byte_portable(const char * s, size_t n, char c) {
+	const void * at = memchr(s, c, n);
+	return at ? (const char *)at - s : -1;
+}
+
+inline ptrdiff_t find_portable(const char * s, size_t n, const char * needle, size_t m) {
+	if (n < m)
+		return -1;
+	const char * end = s + n - m + 1;
+	for (const char * p = s; p < end; p++) {
+		p = (const char *)memchr(p, needle[0], end - p);
+		if (!p)
+			return -1;
+		if (p[m - 1] == needle[m - 1] && memcmp(p + 1, needle + 1, m - 2) == 0)
+			return p - s;
+	}
+	return -1;
+}
+
+inline bool always_supported() {
+	return true;
+}
+
+#ifdef SLVM_X86_KERNELS
+inline ptrdiff_t find_byte_sse2(const char * s, size_t n, char c) {
+	__m128i v = _mm_set1_epi8(c);
+	size_t i = 0;
+	// 64 bytes at a time, finding which block matched only when one did
+	for (; i + 64 <= n; i += 64) {
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i)), v);
+		__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i + 16)), v);
+		__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i + 32)), v);
+		__m128i e3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s + i + 48)), v);
+		if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(e0, e1), _mm_or_si128(e2, e3))))
+			continue;
+		uint64_t mask = (uint64_t)_mm_movemask_epi8(e0) | (uint64_t)_mm_movemask_epi8(e1) << 16
+			| (uint64_t)_mm_movemask_epi8(e2) << 32 | (uint64_t)_mm_movemask_epi8(e3) << 48;
+		return i + __builtin_ctzll(mask);
+	}
+	for (; i + 16 <= n; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(s + i));
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, v));
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+	for (; i < n; i++)
+		if (s[i] == c)
+			return i;
+	return -1;
+}
+
+// 0xff for every one of the 16 positions at `s` where the needle's first and
+// last bytes both are
+inline __m128i candidates_sse2(const char * s, size_t m, __m128i first, __m128i last) {
+	__m128i a = _mm_loadu_si128((const __m128i *)s);
+	__m128i b = _mm_loadu_si128((const __m128i *)(s + m - 1));
+	return _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last));
+}
+
+inline ptrdiff_t find_sse2(const char * s, size_t n, const char * needle, size_t m) {
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i last = _mm_set1_epi8(needle[m - 1]);
+	size_t i = 0;
+	// position i + 63 still has its last byte inside the text
+	for (; i + m + 63 <= n; i += 64) {
+		__m128i c0 = candidates_sse2(s + i, m, first, last);
+		__m128i c1 = candidates_sse2(s + i + 16, m, first, last);
+		__m128i c2 = candidates_sse2(s + i + 32, m, first, last);
+		__m128i c3 = candidates_sse2(s + i + 48, m, first, last);
+		if (!_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(c0, c1), _mm_or_si128(c2, c3))))
+			continue;
+		uint64_t mask = (uint64_t)_mm_movemask_epi8(c0) | (uint64_t)_mm_movemask_epi8(c1) << 16
+			| (uint64_t)_mm_movemask_epi8(c2) << 32 | (uint64_t)_mm_movemask_epi8(c3) << 48;
+		while (mask) {
+			unsigned bit = __builtin_ctzll(mask);
+			if (memcmp(s + i + bit + 1, needle + 1, m - 2) == 0)
+				return i + bit;
+			mask &= mask - 1;
+		}
+	}
+	for (; i + m + 15 <= n; i += 16) {
+		unsigned mask = _mm_movemask_epi8(candidates_sse2(s + i, m, first, last));
+		while (mask) {
+			unsigned bit = __builtin_ctz(mask);
+			if (memcmp(s + i + bit + 1, needle + 1, m - 2) == 0)
+				return i + bit;
+			mask &= mask - 1;
+		}
+	}
+	ptrdiff_t rest = find_portable(s + i, n - i, needle, m);
+	return rest < 0 ? -1 : i + rest;
+}
+
+__attribute__((target("avx2")))
+inline ptrdiff_t find_byte_avx2(const char * s, size_t n, char c) {
+	__m256i v = _mm256_set1_epi8(c);
+	size_t i = 0;
+	for (; i + 128 <= n; i += 128) {
+		__m256i e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i)), v);
+		__m256i e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + 32)), v);
+		__m256i e2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + 64)), v);
+		__m256i e3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s + i + 96)), v);
+		__m256i any = _mm256_or_si256(_mm256_or_si256(e0, e1), _mm256_or_si256(e2, e3));
+		if (_mm256_testz_si256(any, any))
+			continue;
+		uint64_t low = (uint32_t)_mm256_movemask_epi8(e0) | (uint64_t)(uint32_t)_mm256_movemask_epi8(e1) << 32;
+		if (low)
+			return i + __builtin_ctzll(low);
+		uint64_t high = (uint32_t)_mm256_movemask_epi8(e2) | (uint64_t)(uint32_t)_mm256_movemask_epi8(e3) << 32;
+		return i + 64 + __builtin_ctzll(high);
+	}
+	ptrdiff_t rest = find_byte_sse2(s + i, n - i, c);
+	return rest < 0 ? -1 : i + rest;
+}
+
+__attribute__((target("avx2")))
+inline __m256i candidates_avx2(const char * s, size_t m, __m256i first, __m256i last) {
+	__m256i a = _mm256_loadu_si256((const __m256i *)s);
+	__m256i b = _mm256_loadu_si256((const __m256i *)(s + m - 1));
+	return _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last));
+}
+
+__attribute__((target("avx2")))
+inline ptrdiff_t find_avx2(const char * s, size_t n, const char * needle, size_t m) {
+	__m256i first = _mm256_set1_epi8(needle[0]);
+	__m256i last = _mm256_set1_epi8(needle[m - 1]);
+	size_t i = 0;
+	for (; i + m + 127 <= n; i += 128) {
+		__m256i c0 = candidates_avx2(s + i, m, first, last);
+		__m256i c1 = candidates_avx2(s + i + 32, m, first, last);
+		__m256i c2 = candidates_avx2(s + i + 64, m, first, last);
+		__m256i c3 = candidates_avx2(s + i + 96, m, first, last);
+		__m256i any = _mm256_or_si256(_mm256_or_si256(c0, c1), _mm256_or_si256(c2, c3));
+		if (_mm256_testz_si256(any, any))
+			continue;
+		// at most 4 * 32 candidates, checked in order
+		uint32_t masks[4] = {
+			(uint32_t)_mm256_movemask_epi8(c0), (uint32_t)_mm256_movemask_epi8(c1),
+			(uint32_t)_mm256_movemask_epi8(c2), (uint32_t)_mm256_movemask_epi8(c3),
+		};
+		for (size_t b = 0; b < 4; b++) {
+			uint32_t mask = masks[b];
+			while (mask) {
+				unsigned bit = __builtin_ctz(mask);
+				if (memcmp(s + i + b * 32 + bit + 1, needle + 1, m - 2) == 0)
+					return i + b * 32 + bit;
+				mask &= mask - 1;
+			}
+		}
+	}
+	for (; i + m + 31 <= n; i += 32) {
+		uint32_t mask = _mm256_movemask_epi8(candidates_avx2(s + i, m, first, last));
+		while (mask) {
+			unsigned bit = __builtin_ctz(mask);
+			if (memcmp(s + i + bit + 1, needle + 1, m - 2) == 0)
+				return i + bit;
+			mask &= mask - 1;
+		}
+	}
+	ptrdiff_t rest = find_sse2(s + i, n - i, needle, m);
+	return rest < 0 ? -1 : i + rest;
+}
+
+inline bool avx2_supported() {
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+
+// from the slowest to the fastest
+const StringKernels STRING_KERNELS[] = {
+	{"portable", find_byte_portable, find_portable, always_supported},
+#ifdef SLVM_X86_KERNELS
+	{"sse2", find_byte_sse2, find_sse2, always_supported},
+	{"avx2", find_byte_avx2, find_avx2, avx2_supported},
+#endif
+};
+const size_t STRING_KERNEL_COUNT = sizeof(STRING_KERNELS) / sizeof(STRING_KERNELS[0]);
+
+inline const StringKernels * choose_string_kernels() {
+	const char * wanted = getenv("SLVM_STRING_KERNELS");
+	const StringKernels * best = &STRING_KERNELS[0];
+	for (const StringKernels & k : STRING_KERNELS) {
+		if (!k.supported())
+			continue;
+		if (wanted && strcmp(wanted, k.name) == 0)
+			return &k;
+		best = &k;
+	}
+	return best;
+}
+
+inline const StringKernels & string_kernels() {
+	static const StringKernels * kernels = choose_string_kernels();
+	return *kernels;
+}
+
+// while the first byte of the needle is rare, skipping from one to the next
+// with find_byte is faster than the first/last byte filter, which reads the
+// text twice. once it turns up more often than every FILTER_DENSITY bytes,
+// the rest of the text is left to the filter
+const size_t FILTER_DENSITY = 64;
+
+// the index of the first `needle` in `text`, or -1. an empty needle is at 0
+inline ptrdiff_t find_text(std::string_view text, std::string_view needle) {
+	const char * s = text.data();
+	size_t n = text.size();
+	size_t m = needle.size();
+	if (m > n)
+		return -1;
+	if (m == 0)
+		return 0;
+	const StringKernels & k = string_kernels();
+	if (m == 1)
+		return k.find_byte(s, n, needle[0]);
+	size_t misses = 0;
+	size_t i = 0;
+	while (i + m <= n) {
+		ptrdiff_t at = k.find_byte(s + i, n - m + 1 - i, needle[0]);
+		if (at < 0)
+			return -1;
+		i += at;
+		if (s[i + m - 1] == needle[m - 1] && memcmp(s + i + 1, needle.data() + 1, m - 2) == 0)
+			return i;
+		i++;
+		if (++misses > 4 && misses * FILTER_DENSITY > i) {
+			ptrdiff_t rest = k.find(s + i, n - i, needle.data(), m);
+			return rest < 0 ? -1 : i + rest;
+		}
+	}
+	return -1;
+}
+
+inline ptrdiff_t find_char(std::string_view text, char c) {
+	return string_kernels().find_byte(text.data(), text.size(), c);
+}
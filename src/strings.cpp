@@ -0,0 +1,309 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+
+struct StringHeap;
+
+// a string created while the program runs. it is reference counted by the
+// cells pointing to it and goes back to its heap once the last one lets
+// go. the characters follow the header and are always null terminated.
+//
+// the result of a long join is a rope instead: where the characters would
+// be, it holds the two strings it joins, see StringHeap::join. it is only
+// flattened when its characters are read, which lets a program append to
+// a string over and over without copying it every time.
+struct HeapString {
+	StringHeap * heap;
+	uint32_t refs : 31;
+	uint32_t rope : 1;
+	uint32_t size;
+
+	// the characters of a string that is not a rope
+	char * chars() {
+		return (char *)(this + 1);
+	}
+
+	// flattens a rope, see StringHeap::flatten
+	HeapString * flat();
+
+	char * data() {
+		return flat()->chars();
+	}
+
+	std::string str() {
+		return std::string(data(), size);
+	}
+};
+
+// the two halves of a rope. once it is flattened, `left` is the flat copy
+// and `right` is NULL
+struct RopeHalves {
+	HeapString * left;
+	HeapString * right;
+};
+
+inline RopeHalves & halves(HeapString * rope) {
+	return *(RopeHalves *)(rope + 1);
+}
+
+// strings are carved out of big arena chunks, using one free list per
+// power of two size class. anything bigger than the largest class gets
+// its own allocation. destroying the heap frees every string it handed
+// out, whether or not it is still referenced, so cells do not have to be
+// cleared one by one when a state goes away.
+struct StringHeap {
+	static constexpr size_t MIN_BLOCK = 32;
+	static constexpr size_t CLASSES = 8; // 32 .. 4096 bytes
+	static constexpr size_t CHUNK_SIZE = 0x10000;
+	// joins shorter than this are copied right away. a rope node is no
+	// smaller than a short string and reading it costs a flatten
+	static constexpr size_t ROPE_MIN = 256;
+
+	std::vector<char *> chunks;
+	std::set<HeapString *> large;
+	HeapString * free_lists[CLASSES];
+	char * bump;
+	size_t bump_left;
+
+	// stats, see print_stats
+	size_t live_strings;
+	size_t live_bytes;   // characters in live strings
+	size_t created;
+	size_t freed;
+	size_t arena_bytes;  // memory taken from the system for the arena
+	size_t ropes;
+	size_t flattened;
+
+	// scratch for flatten and destroy, which walk ropes without recursing
+	// because a string built one join at a time is a rope as deep as the
+	// number of joins
+	std::vector<HeapString *> walk;
+	std::vector<HeapString *> doomed;
+
+	StringHeap() {
+		for (size_t i = 0; i < CLASSES; i++)
+			free_lists[i] = NULL;
+		bump = NULL;
+		bump_left = 0;
+		live_strings = 0;
+		live_bytes = 0;
+		created = 0;
+		freed = 0;
+		arena_bytes = 0;
+		ropes = 0;
+		flattened = 0;
+	}
+
+	~StringHeap() {
+		for (char * chunk : chunks)
+			free(chunk);
+		for (HeapString * s : large)
+			free(s);
+	}
+
+	StringHeap(const StringHeap &) = delete;
+	StringHeap & operator=(const StringHeap &) = delete;
+
+	// returns the size class for a block of `bytes`, or CLASSES if it is too big
+	static size_t size_class(size_t bytes) {
+		size_t c = 0;
+		size_t block = MIN_BLOCK;
+		while (block < bytes && c < CLASSES) {
+			block <<= 1;
+			c++;
+		}
+		return c;
+	}
+
+	HeapString * allocate(size_t bytes) {
+		size_t c = size_class(bytes);
+		HeapString * s;
+		if (c == CLASSES) {
+			s = (HeapString *)malloc(bytes);
+			large.insert(s);
+		} else if (free_lists[c]) {
+			s = free_lists[c];
+			// free blocks link to each other through the heap pointer
+			free_lists[c] = (HeapString *)s->heap;
+		} else {
+			size_t block = MIN_BLOCK << c;
+			if (bump_left < block) {
+				bump = (char *)malloc(CHUNK_SIZE);
+				bump_left = CHUNK_SIZE;
+				chunks.push_back(bump);
+				arena_bytes += CHUNK_SIZE;
+			}
+			s = (HeapString *)bump;
+			bump += block;
+			bump_left -= block;
+		}
+		s->heap = this;
+		s->refs = 1;
+		created++;
+		return s;
+	}
+
+	static size_t block_bytes(HeapString * s) {
+		return sizeof(HeapString) + (s->rope ? sizeof(RopeHalves) : s->size + 1);
+	}
+
+	// a string of `size` characters that the caller fills in. it has one
+	// reference, owned by the caller
+	HeapString * create_uninitialized(size_t size) {
+		HeapString * s = allocate(sizeof(HeapString) + size + 1);
+		s->rope = 0;
+		s->size = size;
+		s->chars()[size] = '\0';
+
+		live_strings++;
+		live_bytes += size;
+		return s;
+	}
+
+	// the returned string has one reference, owned by the caller
+	HeapString * create(const char * data, size_t size) {
+		HeapString * s = create_uninitialized(size);
+		memcpy(s->chars(), data, size);
+		return s;
+	}
+
+	HeapString * create(const std::string & s) {
+		return create(s.data(), s.size());
+	}
+
+	// `a` followed by `b`, copied into one string
+	HeapString * concat(std::string_view a, std::string_view b) {
+		HeapString * s = create_uninitialized(a.size() + b.size());
+		memcpy(s->chars(), a.data(), a.size());
+		memcpy(s->chars() + a.size(), b.data(), b.size());
+		return s;
+	}
+
+	// a rope of `left` followed by `right`, taking over the references of
+	// the caller. the sizes must add up to at most UINT32_MAX
+	HeapString * join(HeapString * left, HeapString * right) {
+		HeapString * s = allocate(sizeof(HeapString) + sizeof(RopeHalves));
+		s->rope = 1;
+		s->size = left->size + right->size;
+		halves(s) = {left, right};
+
+		live_strings++;
+		ropes++;
+		return s;
+	}
+
+	// `left` followed by `right`, which is shorter than ROPE_MIN, taking
+	// over the reference of the caller to `left`. when `left` is a rope
+	// that ends in a short string, `right` is copied onto the end of that
+	// one instead, so appending piece by piece makes a node for every
+	// ROPE_MIN characters or so, not for every piece
+	HeapString * append(HeapString * left, std::string_view right) {
+		if (left->rope) {
+			RopeHalves h = halves(left);
+			if (h.right && !h.right->rope && h.right->size + right.size() < ROPE_MIN) {
+				HeapString * leaf = concat(std::string_view(h.right->chars(), h.right->size), right);
+				h.left->refs++;
+				if (--left->refs == 0)
+					destroy(left);
+				return join(h.left, leaf);
+			}
+		}
+		return join(left, create(right.data(), right.size()));
+	}
+
+	// copies the characters of a rope into one new string, which the rope
+	// keeps from then on in place of its halves
+	HeapString * flatten(HeapString * rope) {
+		RopeHalves & h = halves(rope);
+		if (!h.right)
+			return h.left;
+		HeapString * flat = create_uninitialized(rope->size);
+		char * out = flat->chars();
+		walk.push_back(rope);
+		while (!walk.empty()) {
+			HeapString * s = walk.back();
+			walk.pop_back();
+			if (s->rope && halves(s).right) {
+				walk.push_back(halves(s).right);
+				walk.push_back(halves(s).left);
+				continue;
+			}
+			if (s->rope)
+				s = halves(s).left;
+			memcpy(out, s->chars(), s->size);
+			out += s->size;
+		}
+		HeapString * left = h.left;
+		HeapString * right = h.right;
+		h = {flat, NULL};
+		release_child(left);
+		release_child(right);
+		drain();
+		flattened++;
+		return flat;
+	}
+
+	void destroy(HeapString * s) {
+		doomed.push_back(s);
+		drain();
+	}
+
+	// like release, but leaves destroying the string to drain
+	void release_child(HeapString * s) {
+		if (--s->refs == 0)
+			doomed.push_back(s);
+	}
+
+	// frees every doomed string, and whatever only they referenced
+	void drain() {
+		while (!doomed.empty()) {
+			HeapString * s = doomed.back();
+			doomed.pop_back();
+			if (s->rope) {
+				release_child(halves(s).left);
+				if (halves(s).right)
+					release_child(halves(s).right);
+			} else {
+				live_bytes -= s->size;
+			}
+			live_strings--;
+			freed++;
+
+			size_t c = size_class(block_bytes(s));
+			if (c == CLASSES) {
+				large.erase(s);
+				free(s);
+				continue;
+			}
+			s->heap = (StringHeap *)free_lists[c];
+			free_lists[c] = s;
+		}
+	}
+
+	void print_stats(FILE * out) {
+		fprintf(
+			out,
+			"strings: %zu live (%zu bytes), %zu created, %zu freed, %zu bytes of arena, %zu joins kept as ropes, %zu flattened\n",
+			live_strings, live_bytes, created, freed, arena_bytes, ropes, flattened
+		);
+	}
+};
+
+inline void retain(HeapString * s) {
+	s->refs++;
+}
+
+inline void release(HeapString * s) {
+	if (--s->refs == 0)
+		s->heap->destroy(s);
+}
+
+inline HeapString * HeapString::flat() {
+	return rope ? heap->flatten(this) : this;
+}
@@ -0,0 +1,134 @@
+#pragma once
+#include <stdio.h>
+#include <stdint.h>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+// binary execution trace, written with --trace when built with SLVM_TRACE.
+// the interpreter pushes one TraceRecord per executed instruction into a
+// lock free single producer single consumer ring, and a background thread
+// drains it into the trace file. tools/trace-decode.cpp reads it back.
+//
+// file layout: a TraceHeader followed by TraceRecords until the end.
+
+#define TRACE_MAGIC "SLVMTRC"
+#define TRACE_VERSION 1
+
+enum TraceValueKind : uint8_t {
+	TV_UNINIT,
+	TV_NUM,
+	TV_STR
+};
+
+struct TraceHeader {
+	char magic[8];     // TRACE_MAGIC, null terminated
+	uint32_t version;  // TRACE_VERSION
+	uint32_t record_size;
+};
+
+struct TraceRecord {
+	uint32_t ip;       // index of the instruction in the decoded program
+	uint16_t op;       // Instruction
+	uint8_t kind;      // TraceValueKind of the accumulator, before the instruction ran
+	uint8_t reserved;
+	float accumulator; // its value, if it is a number
+};
+static_assert(sizeof(TraceRecord) == 12, "trace records are written as is");
+
+struct Tracer {
+	static constexpr size_t CAPACITY = 1 << 16; // records, must be a power of two
+	static constexpr size_t BATCH = 4096;
+	// how often the writer looks at an empty ring again right away before
+	// it sleeps between looks. at the tens of millions of records a second
+	// the interpreter makes, the ring takes about a millisecond to fill
+	static constexpr int IDLE_SPINS = 64;
+	static constexpr auto IDLE_SLEEP = std::chrono::microseconds(100);
+
+	TraceRecord * ring;
+	std::atomic<size_t> head; // next record to write, only moved by the interpreter
+	std::atomic<size_t> tail; // next record to drain, only moved by the writer
+	std::atomic<bool> done;
+	FILE * out;
+	std::thread writer;
+
+	Tracer() {
+		ring = NULL;
+		out = NULL;
+		head = 0;
+		tail = 0;
+		done = false;
+	}
+
+	~Tracer() {
+		stop();
+		delete[] ring;
+	}
+
+	bool start(const char * path) {
+		out = fopen(path, "wb");
+		if (!out)
+			return false;
+		TraceHeader header = {};
+		strcpy(header.magic, TRACE_MAGIC);
+		header.version = TRACE_VERSION;
+		header.record_size = sizeof(TraceRecord);
+		fwrite(&header, sizeof(header), 1, out);
+		ring = new TraceRecord[CAPACITY];
+		writer = std::thread(&Tracer::drain, this);
+		return true;
+	}
+
+	// flushes everything and closes the file
+	void stop() {
+		if (!writer.joinable())
+			return;
+		done.store(true, std::memory_order_release);
+		writer.join();
+		fclose(out);
+		out = NULL;
+	}
+
+	inline void record(uint32_t ip, uint16_t op, uint8_t kind, float accumulator) {
+		size_t h = head.load(std::memory_order_relaxed);
+		// wait for the writer if the ring is full, rather than dropping records
+		while (h - tail.load(std::memory_order_acquire) == CAPACITY)
+			std::this_thread::yield();
+		TraceRecord & r = ring[h & (CAPACITY - 1)];
+		r.ip = ip;
+		r.op = op;
+		r.kind = kind;
+		r.reserved = 0;
+		r.accumulator = accumulator;
+		head.store(h + 1, std::memory_order_release);
+	}
+
+	void drain() {
+		int idle = 0;
+		while (true) {
+			// read done first, so nothing recorded before stop() is missed
+			bool finished = done.load(std::memory_order_acquire);
+			size_t t = tail.load(std::memory_order_relaxed);
+			size_t h = head.load(std::memory_order_acquire);
+			if (h == t) {
+				if (finished)
+					return;
+				// the interpreter runs on, sleeps or waits for input; do
+				// not keep a core busy looking
+				if (idle < IDLE_SPINS) {
+					idle++;
+					std::this_thread::yield();
+				} else
+					std::this_thread::sleep_for(IDLE_SLEEP);
+				continue;
+			}
+			idle = 0;
+			// write up to the end of the ring, the rest comes next round
+			size_t start = t & (CAPACITY - 1);
+			size_t n = std::min(h - t, std::min(BATCH, CAPACITY - start));
+			fwrite(ring + start, sizeof(TraceRecord), n, out);
+			tail.store(t + n, std::memory_order_release);
+		}
+	}
+};
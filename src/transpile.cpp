@@ -0,0 +1,241 @@
+#pragma once
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "pre-parser.cpp"
+#include "SLVM.cpp"
+
+// --emit-cpp: translates a decoded program into a C++ source file that runs
+// it without an interpreter loop. jumps become gotos between labels. jts
+// pushes its own index like the interpreter does, and ret jumps through a
+// switch over all return sites, one case per jts.
+//
+// the accumulator and the addresses of the variables are kept in locals of
+// the translated function. cells are written one tag byte at a time, and
+// as far as the compiler knows such a write could change anything that is
+// reached through a pointer, so this is what lets it keep them in
+// registers. loads, stores, arithmetic and comparisons are written out
+// inline. every other instruction calls its handler with an instruction
+// from a constant table, which the compiler inlines and specialises, and
+// the accumulator is handed over to the state around the call.
+//
+// the output includes aot.cpp, which supplies main() and the runtime. build
+// it with the CSLVM sources on the include path:
+//   c++ -std=c++17 -O2 -I <CSLVM>/src prog.cpp -o prog -pthread
+
+// the name of the handler of every instruction
+#define HANDLER_NAME(op, f) #f,
+const char * handler_names[] = {
+	"",
+	SLVM_HANDLERS(HANDLER_NAME)
+};
+#undef HANDLER_NAME
+
+// a string literal with the same bytes as `s`
+inline void emit_string(FILE * out, std::string_view s) {
+	fprintf(out, "std::string_view(\"");
+	for (char ch : s) {
+		unsigned char c = ch;
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c >= 0x20 && c < 0x7f)
+			fputc(c, out);
+		else
+			fprintf(out, "\\%03o", c); // always three digits, so a digit after it stays a digit
+	}
+	fprintf(out, "\", %zu)", s.size());
+}
+
+// a num_t literal with exactly the value of `n`
+inline void emit_num(FILE * out, num_t n) {
+	if (isnan(n))
+		fprintf(out, "NAN");
+	else if (isinf(n))
+		fprintf(out, n < 0 ? "-INFINITY" : "INFINITY");
+	else
+		fprintf(out, "num_t(%a)", (double)n);
+}
+
+// the arithmetic of an instruction that combines the accumulator with a
+// variable, exactly as its handler does it. empty for other instructions
+inline std::string with_var_expression(Instruction op, const std::string & a, const std::string & b) {
+	std::string ia = "addr_t(" + a + ")";
+	std::string ib = "addr_t(" + b + ")";
+	switch (op) {
+		case I_addWithVar:                  return a + " + " + b;
+		case I_subWithVar:                  return a + " - " + b;
+		case I_mulWithVar:                  return a + " * " + b;
+		case I_divWithVar:                  return a + " / " + b;
+		case I_bitwiseLsfWithVar:           return ia + " << " + ib;
+		case I_bitwiseRsfWithVar:           return ia + " >> " + ib;
+		case I_bitwiseAndWithVar:           return ia + " & " + ib;
+		case I_bitwiseOrWithVar:            return ia + " | " + ib;
+		case I_modWithVar:                  return ia + " % " + ib;
+		case I_boolAndWithVar:              return ia + " && " + ib;
+		case I_boolOrWithVar:               return ia + " || " + ib;
+		case I_boolEqualWithVar:            return ia + " == " + ib;
+		case I_largerThanOrEqualWithVar:    return ia + " >= " + ib;
+		case I_smallerThanOrEqualWithVar:   return ia + " <= " + ib;
+		case I_boolNotEqualWithVar:         return ia + " != " + ib;
+		case I_smallerThanWithVar:          return ia + " < " + ib;
+		case I_largerThanWithVar:           return ia + " > " + ib;
+		default:                            return "";
+	}
+}
+
+// writes the program as C++. `code` must not have been fused, the C++
+// compiler does a better job of combining instructions.
+// returns false if writing failed
+inline bool emit_cpp(FILE * out, InstructionStorage & store, const std::string & source_path, addr_t memory_size) {
+	const DecodedInstruction * code = store.code;
+	size_t code_size = store.code_size;
+
+	// only instructions that are jumped to need a label
+	std::vector<bool> labelled(code_size, false);
+	std::vector<size_t> return_sites;
+	bool has_ret = false;
+	for (size_t i = 0; i < code_size; i++) {
+		const char * sig = instruction_signature[code[i].op];
+		for (size_t a = 0; sig[a]; a++)
+			if (sig[a] == 't')
+				labelled[code[i].args[a]] = true;
+		if (code[i].op == I_jts) {
+			// code ends with done, so there is always an instruction after a jts
+			labelled[i + 1] = true;
+			return_sites.push_back(i);
+		}
+		has_ret |= code[i].op == I_ret;
+	}
+
+	fprintf(out, "// translated from %s by CSLVM --emit-cpp, see src/transpile.cpp.\n", source_path.c_str());
+	fprintf(out, "// build with: c++ -std=c++17 -O2 -I <CSLVM>/src <this file> -pthread\n");
+	fprintf(out, "#include \"aot.cpp\"\n\n");
+
+	fprintf(out, "static const DecodedInstruction code[] = {\n");
+	for (size_t i = 0; i < code_size; i++) {
+		const DecodedInstruction & ins = code[i];
+		fprintf(
+			out, "\t{I_%s, %d, {%d, %d, %d, %d}},\n",
+			instruction_name(ins.op).c_str(), ins.line,
+			ins.args[0], ins.args[1], ins.args[2], ins.args[3]
+		);
+	}
+	fprintf(out, "};\n\n");
+
+	// both tables end with an unused entry, so they are never empty
+	fprintf(out, "static const std::string_view names[] = {\n");
+	for (std::string_view name : store.names) {
+		fprintf(out, "\t");
+		emit_string(out, name);
+		fprintf(out, ",\n");
+	}
+	fprintf(out, "\t{}\n};\n\n");
+
+	fprintf(out, "static const Constant constants[] = {\n");
+	for (const Constant & c : store.constants) {
+		fprintf(out, "\t{");
+		emit_string(out, c.text);
+		fprintf(out, ", ");
+		emit_num(out, c.n);
+		fprintf(out, ", %s},\n", c.is_num ? "true" : "false");
+	}
+	fprintf(out, "\t{}\n};\n\n");
+
+	fprintf(out, "static void run(SLVM_state * state) {\n");
+	fprintf(out, "\tusing namespace Instructions;\n");
+	fprintf(out, "\tMemoryCell * memory = state->memory;\n");
+	fprintf(out, "\tMemoryCell acc = state->accumulator;\n");
+	for (size_t n = 0; n < store.names.size(); n++)
+		fprintf(out, "\taddr_t v%zu = state->var_addr[%zu];\n", n, n);
+	// the handlers use the accumulator of the state
+	const char * to_state = "\tstate->accumulator = acc;\n";
+	const char * from_state = "\tacc = state->accumulator;\n";
+	const char * stop = "\tif (!state->running) {\n\t\tstate->accumulator = acc;\n\t\treturn;\n\t}\n";
+	for (size_t i = 0; i < code_size; i++) {
+		const DecodedInstruction & ins = code[i];
+		if (labelled[i])
+			fprintf(out, "L_%zu:\n", i);
+		fprintf(out, "\t// %s @ %d\n", instruction_name(ins.op).c_str(), ins.line + 1);
+		std::string var = "memory[v" + std::to_string(ins.args[0]) + "]";
+		std::string expression = with_var_expression(ins.op, "acc.get_num()", var + ".get_num()");
+		switch (ins.op) {
+			// the same as the handlers, on the locals
+			case I_ldi:
+				fprintf(out, "\tacc.set_constant(&constants[%d]);\n", ins.args[0]);
+				break;
+			case I_loadAtVar:
+				fprintf(out, "\tacc.copy_from(%s);\n", var.c_str());
+				break;
+			case I_storeAtVar:
+				fprintf(out, "\t%s.copy_from(acc);\n", var.c_str());
+				break;
+			case I_inc:
+			case I_dec:
+				fprintf(out, "\t%s.set_num(%s.get_num() %c 1);\n", var.c_str(), var.c_str(), ins.op == I_inc ? '+' : '-');
+				break;
+			case I_jmp:
+				fprintf(out, "\tgoto L_%d;\n", ins.args[0]);
+				break;
+			case I_jt:
+				fprintf(out, "\tif (acc.get_num() > 0)\n\t\tgoto L_%d;\n", ins.args[0]);
+				break;
+			case I_jf:
+				fprintf(out, "\tif (acc.get_num() < 1)\n\t\tgoto L_%d;\n", ins.args[0]);
+				break;
+			// neither jts nor ret touch the accumulator
+			case I_jts:
+				fprintf(out, "\tstate->instruction_pointer = %zu;\n", i);
+				fprintf(out, "\tfI_jts(state, code[%zu]);\n", i);
+				fprintf(out, "%s", stop);
+				fprintf(out, "\tgoto L_%d;\n", ins.args[0]);
+				break;
+			case I_ret:
+				fprintf(out, "\tfI_ret(state, code[%zu]);\n", i);
+				fprintf(out, "%s", stop);
+				fprintf(out, "\tgoto return_site;\n");
+				break;
+			case I_done:
+				fprintf(out, "%s", to_state);
+				fprintf(out, "\tfI_done(state, code[%zu]);\n", i);
+				fprintf(out, "\treturn;\n");
+				break;
+			default:
+				if (!expression.empty()) {
+					fprintf(out, "\tacc.set_num(%s);\n", expression.c_str());
+					break;
+				}
+				fprintf(out, "%s", to_state);
+				fprintf(out, "\t%s(state, code[%zu]);\n", handler_names[ins.op], i);
+				fprintf(out, "%s", from_state);
+				if (ins.op == I_setVarAddress)
+					fprintf(out, "\tv%d = state->var_addr[%d];\n", ins.args[0], ins.args[0]);
+				if (instruction_may_stop(ins.op))
+					fprintf(out, "%s", stop);
+				break;
+		}
+	}
+	if (has_ret) {
+		// fI_ret left the index of the jts in instruction_pointer
+		fprintf(out, "return_site:\n");
+		fprintf(out, "\tswitch (state->instruction_pointer) {\n");
+		for (size_t site : return_sites)
+			fprintf(out, "\t\tcase %zu: goto L_%zu;\n", site, site + 1);
+		fprintf(out, "\t\tdefault:\n\t\t\tstate->accumulator = acc;\n\t\t\tstate->running = false;\n\t\t\treturn;\n");
+		fprintf(out, "\t}\n");
+	}
+	fprintf(out, "}\n\n");
+
+	fprintf(out, "int main(int argc, char * argv[]) {\n");
+	fprintf(out, "\tCompiledProgram program = {\n");
+	fprintf(out, "\t\tcode, %zu,\n", code_size);
+	fprintf(out, "\t\tnames, %zu,\n", store.names.size());
+	fprintf(out, "\t\tconstants, %zu,\n", store.constants.size());
+	fprintf(out, "\t\t%d,\n", memory_size);
+	fprintf(out, "\t\trun\n");
+	fprintf(out, "\t};\n");
+	fprintf(out, "\treturn run_compiled(program, argc, argv);\n");
+	fprintf(out, "}\n");
+	return !ferror(out);
+}
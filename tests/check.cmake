@@ -0,0 +1,23 @@
+# runs one regression program and compares what it prints with the .out
+# file next to it. cmake -DCSLVM=<binary> -DPROGRAM=<x.slvm.txt> -P check.cmake
+# optionally -DARGS="<arguments for CSLVM>", -DRESULT=<expected exit code>
+# and -DEXPECTED=<the .out file to compare with instead>
+if(NOT DEFINED EXPECTED)
+	string(REGEX REPLACE "\\.slvm\\.txt$" ".out" EXPECTED "${PROGRAM}")
+endif()
+if(NOT DEFINED RESULT)
+	set(RESULT 0)
+endif()
+separate_arguments(ARGS)
+execute_process(
+	COMMAND "${CSLVM}" ${ARGS} "${PROGRAM}"
+	OUTPUT_VARIABLE output
+	RESULT_VARIABLE result
+)
+file(READ "${EXPECTED}" expected)
+if(NOT result EQUAL RESULT)
+	message(FATAL_ERROR "${PROGRAM} exited with ${result} instead of ${RESULT}\n${output}")
+endif()
+if(NOT output STREQUAL expected)
+	message(FATAL_ERROR "${PROGRAM} printed\n${output}\ninstead of\n${expected}")
+endif()
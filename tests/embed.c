@@ -0,0 +1,131 @@
+// runs a program through the C API of the cslvm library, see src/cslvm.h:
+// in slices, for a while, with variables set and read by the host and with
+// its printing and asking going to callbacks. exits with 1 if anything is
+// not as it should be
+#include <stdio.h>
+#include <string.h>
+
+#include "cslvm.h"
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+	if (!(condition)) { \
+		printf("%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+		failures++; \
+	} \
+} while (0)
+
+// asks for a name, counts i up to limit and prints both
+static const char PROGRAM[] =
+	"ldi\n" "name?\n" "ask\n" "storeAtVar\n" "name\n"
+	"ldi\n" "0\n" "storeAtVar\n" "i\n"
+	"loadAtVar\n" "i\n" "smallerThanWithVar\n" "limit\n" "jf\n" "19\n" // 9
+	"inc\n" "i\n" "jmp\n" "9\n"
+	"loadAtVar\n" "name\n" "println\n" // 19
+	"done\n";
+
+struct printed {
+	char text[256];
+	size_t size;
+};
+
+static void print(void * user, const char * text, size_t size) {
+	struct printed * p = (struct printed *)user;
+	if (p->size + size < sizeof(p->text)) {
+		memcpy(p->text + p->size, text, size);
+		p->size += size;
+		p->text[p->size] = '\0';
+	}
+}
+
+static int asked = 0;
+
+static const char * ask(void * user, const char * question, size_t question_size, size_t * answer_size) {
+	asked++;
+	CHECK(question_size == 5 && memcmp(question, "name?", 5) == 0);
+	*answer_size = 3;
+	return (const char *)user;
+}
+
+static double get(cslvm_state * state, const char * name) {
+	double value = -1;
+	CHECK(cslvm_get_number(state, name, &value));
+	return value;
+}
+
+int main(void) {
+	cslvm_program * program = cslvm_program_from_text(PROGRAM, sizeof(PROGRAM) - 1);
+	CHECK(program != NULL);
+	if (!program)
+		return 1;
+
+	// in slices, each going on where the last one stopped
+	cslvm_state * state = cslvm_state_new(program, 0);
+	CHECK(state != NULL);
+	struct printed printed = {"", 0};
+	cslvm_set_print(state, print, &printed);
+	cslvm_set_ask(state, ask, (void *)"ada");
+	CHECK(cslvm_set_number(state, "limit", 100));
+	CHECK(cslvm_step(state, 10) == CSLVM_PAUSED);
+	CHECK(asked == 1);
+	double i = get(state, "i");
+	CHECK(i >= 0 && i < 100);
+	int slices = 0;
+	cslvm_stop stop;
+	while ((stop = cslvm_step(state, 10)) == CSLVM_PAUSED)
+		slices++;
+	CHECK(stop == CSLVM_DONE);
+	CHECK(slices > 1);
+	CHECK(get(state, "i") == 100);
+	CHECK(strcmp(printed.text, "ada\n") == 0);
+	CHECK(cslvm_step(state, 10) == CSLVM_DONE);
+
+	// the host's variables, and what the program left in its own
+	double value = 0;
+	CHECK(!cslvm_get_number(state, "nothing", &value));
+	CHECK(cslvm_set_number(state, "x", 2.5));
+	CHECK(get(state, "x") == 2.5);
+	CHECK(cslvm_set_string(state, "s", "hello", 5));
+	char buffer[3];
+	size_t size = 0;
+	CHECK(cslvm_get_string(state, "s", buffer, sizeof(buffer), &size));
+	CHECK(size == 5 && strcmp(buffer, "he") == 0);
+	CHECK(cslvm_get_string(state, "name", NULL, 0, &size) && size == 3);
+	cslvm_state_free(state);
+
+	// for a while: ten million iterations take longer than a millisecond
+	state = cslvm_state_new(program, 0);
+	CHECK(state != NULL);
+	cslvm_set_ask(state, ask, (void *)"bob");
+	cslvm_set_print(state, print, &printed);
+	CHECK(cslvm_set_number(state, "limit", 10000000));
+	CHECK(cslvm_run_for(state, 1000) == CSLVM_PAUSED);
+	CHECK(get(state, "i") > 0);
+	CHECK(cslvm_run(state) == CSLVM_DONE);
+	CHECK(get(state, "i") == 10000000);
+	cslvm_state_free(state);
+
+	// a program whose variables do not fit has no state, and variables of
+	// the host that do not fit are refused without stopping the program
+	CHECK(cslvm_state_new(program, 1) == NULL);
+	int32_t cells = 2;
+	while ((state = cslvm_state_new(program, cells)) == NULL && cells < 64)
+		cells++;
+	CHECK(state != NULL);
+	if (state) {
+		cslvm_set_ask(state, ask, (void *)"cyd");
+		cslvm_set_print(state, print, &printed);
+		CHECK(cslvm_set_number(state, "limit", 3));
+		CHECK(!cslvm_set_number(state, "extra", 1));
+		CHECK(!cslvm_set_string(state, "extra", "no", 2));
+		CHECK(!cslvm_get_number(state, "extra", &value));
+		CHECK(cslvm_run(state) == CSLVM_DONE);
+		CHECK(get(state, "i") == 3);
+		cslvm_state_free(state);
+	}
+
+	cslvm_program_free(program);
+	printf("%d failures\n", failures);
+	return failures ? 1 : 0;
+}
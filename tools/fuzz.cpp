@@ -0,0 +1,311 @@
+// differential fuzzer. generates random programs and runs every one of
+// them in each of the ways CSLVM can run a program: with and without
+// superinstructions, with and without quickening, and with the JIT. all of
+// them have to print the same and stop the same way as the plain
+// interpreter. the programs loop over arithmetic, comparisons, branches,
+// inc/dec, join and sizeOf on variables that start out as numbers, strings
+// or nothing and change between them, so quickened instructions have to
+// go back to their generic forms and the JIT has to leave its blocks.
+//
+// with the JIT, every program is also run with all of its variables moved
+// more than 2^31 bytes into memory, where the JIT cannot address them and
+// has to call the handlers of the interpreter instead.
+//
+// usage: cslvm-fuzz [--seeds FIRST LAST] [--verbose]
+// exits with 1 if any program disagreed, and prints those programs.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "../src/pre-parser.cpp"
+#include "../src/SLVM.cpp"
+#include "../src/jit.cpp"
+
+// where the variables go in far programs, see the top. a multiple of 16,
+// so the addresses of all variables are exact floats
+const uint32_t FAR_ADDRESS = 140000000;
+const uint32_t FAR_MEMORY = 150000000;
+
+// xorshift, the same programs for a seed everywhere
+struct Random {
+	uint64_t s;
+
+	Random(uint64_t seed) {
+		s = seed * 0x9E3779B97F4A7C15ull + 1;
+	}
+
+	uint32_t next() {
+		s ^= s << 13;
+		s ^= s >> 7;
+		s ^= s << 17;
+		return (uint32_t)(s >> 32);
+	}
+
+	// in [0, n)
+	uint32_t below(uint32_t n) {
+		return next() % n;
+	}
+
+	// true `percent` percent of the time
+	bool chance(uint32_t percent) {
+		return below(100) < percent;
+	}
+
+	template <typename T, size_t N>
+	const T & pick(const T (&options)[N]) {
+		return options[below(N)];
+	}
+};
+
+// writes a program one token per line, with jumps to labels
+struct ProgramText {
+	std::vector<std::string> lines;
+	std::map<std::string, size_t> labels;
+	std::vector<size_t> fixups; // lines that name a label
+
+	void op(const std::string & name, std::initializer_list<std::string> args = {}) {
+		lines.push_back(name);
+		for (const std::string & a : args)
+			lines.push_back(a);
+	}
+
+	void jump(const std::string & name, const std::string & label) {
+		lines.push_back(name);
+		fixups.push_back(lines.size());
+		lines.push_back(label);
+	}
+
+	void label(const std::string & name) {
+		labels[name] = lines.size();
+	}
+
+	std::string text() const {
+		std::vector<std::string> out = lines;
+		for (size_t i : fixups)
+			out[i] = std::to_string(labels.at(lines[i]));
+		std::string t;
+		for (const std::string & line : out)
+			t += line + "\n";
+		return t;
+	}
+};
+
+static const char * const VARIABLES[] = {"v0", "v1", "v2", "v3", "v4", "v5"};
+static const char * const NUMBERS[] = {"0", "1", "2", "3", "7", "-4", "2.5", "100", "0.25", "1e3"};
+static const char * const STRINGS[] = {"abc", "12x", "hi"};
+static const char * const CONSTANTS[] = {"3", "0.5", "x", "-1"};
+// not modWithVar: it takes the modulo of integers, which traps on zero
+static const char * const WITH_VAR[] = {
+	"addWithVar", "subWithVar", "mulWithVar", "divWithVar",
+	"bitwiseLsfWithVar", "bitwiseRsfWithVar", "bitwiseAndWithVar", "bitwiseOrWithVar",
+	"boolAndWithVar", "boolOrWithVar", "boolEqualWithVar", "boolNotEqualWithVar",
+	"smallerThanWithVar", "largerThanWithVar", "smallerThanOrEqualWithVar", "largerThanOrEqualWithVar",
+};
+
+static std::string generate(uint64_t seed, bool far) {
+	Random r(seed);
+	ProgramText p;
+	if (far) {
+		uint32_t addr = FAR_ADDRESS;
+		for (const char * v : VARIABLES) {
+			p.op("ldi", {std::to_string(addr)});
+			p.op("setVarAddress", {v});
+			addr += 16;
+		}
+		for (const char * v : {"i", "n", "s", "t"}) {
+			p.op("ldi", {std::to_string(addr)});
+			p.op("setVarAddress", {v});
+			addr += 16;
+		}
+	}
+	for (const char * v : VARIABLES) {
+		uint32_t c = r.below(100);
+		if (c >= 80)
+			continue; // never set
+		p.op("ldi", {c < 60 ? r.pick(NUMBERS) : r.pick(STRINGS)});
+		p.op("storeAtVar", {v});
+	}
+	p.op("ldi", {"0"});
+	p.op("storeAtVar", {"i"});
+	p.op("ldi", {std::to_string(60 + r.below(141))});
+	p.op("storeAtVar", {"n"});
+	p.op("ldi", {"ab"});
+	p.op("storeAtVar", {"s"});
+
+	// the loop, long enough for its blocks to get compiled
+	p.label("top");
+	p.op("loadAtVar", {"i"});
+	p.op("smallerThanWithVar", {"n"});
+	p.jump("jf", "end");
+	int skips = 0;
+	for (uint32_t k = 3 + r.below(23); k > 0; k--) {
+		uint32_t c = r.below(100);
+		std::string v = r.pick(VARIABLES);
+		std::string skip = "s" + std::to_string(skips);
+		if (c < 15)
+			p.op("loadAtVar", {v});
+		else if (c < 20) {
+			// v turns into a string halfway through the loop, after its
+			// instructions were quickened and compiled
+			p.op("ldi", {std::to_string(30 + r.below(30))});
+			p.op("storeAtVar", {"t"});
+			p.op("loadAtVar", {"i"});
+			p.op("boolEqualWithVar", {"t"});
+			p.jump("jf", skip);
+			p.op("ldi", {r.pick(STRINGS)});
+			p.op("storeAtVar", {v});
+			p.label(skip);
+			skips++;
+		}
+		else if (c < 45)
+			p.op(r.pick(WITH_VAR), {v});
+		else if (c < 60)
+			p.op("storeAtVar", {v});
+		else if (c < 65)
+			p.op("ldi", {r.pick(CONSTANTS)});
+		else if (c < 72)
+			p.op("inc", {v});
+		else if (c < 76)
+			p.op("dec", {v});
+		else if (c < 80)
+			p.op("println");
+		else if (c < 84)
+			// s is never written, so strings grow by two bytes a join
+			// rather than doubling
+			p.op("join", {v, "s"});
+		else if (c < 90) {
+			p.jump(r.chance(50) ? "jt" : "jf", skip);
+			p.op("inc", {r.pick(VARIABLES)});
+			p.label(skip);
+			skips++;
+		} else if (c < 93) {
+			// fused into loadAddStore
+			p.op("loadAtVar", {v});
+			p.op("addWithVar", {r.pick(VARIABLES)});
+			p.op("storeAtVar", {r.pick(VARIABLES)});
+		} else if (c < 96) {
+			// fused into loadLargerThanJf
+			p.op("loadAtVar", {"i"});
+			p.op("largerThanWithVar", {v});
+			p.jump("jf", skip);
+			p.op("println");
+			p.label(skip);
+			skips++;
+		} else
+			p.op("sizeOf", {v});
+	}
+	// fused into incJmp
+	p.op("inc", {"i"});
+	p.jump("jmp", "top");
+	p.label("end");
+	for (const char * v : VARIABLES) {
+		p.op("loadAtVar", {v});
+		p.op("println");
+	}
+	p.op("done");
+	return p.text();
+}
+
+// one way of running a program
+struct Mode {
+	const char * name;
+	bool fuse;
+	bool quicken;
+	bool jit;
+};
+
+static const Mode MODES[] = {
+	{"interpreter", false, false, false}, // what the others are compared with
+	{"fused",       true,  false, false},
+	{"quickened",   false, true,  false},
+	{"fused, quickened", true, true, false},
+#ifdef SLVM_JIT
+	{"jit",         true,  true,  true},
+#endif
+};
+
+struct Outcome {
+	std::string output;
+	bool finished; // by done, rather than an error
+};
+
+static void capture(void * context, const char * text, size_t size) {
+	((std::string *)context)->append(text, size);
+}
+
+static Outcome run(const std::string & text, const Mode & mode, addr_t memory_size) {
+	Outcome outcome = {"", false};
+	InstructionStorage store;
+	store.set_text(text);
+	if (!store.decode()) {
+		outcome.output = "<does not decode>";
+		return outcome;
+	}
+	if (mode.fuse)
+		store.fuse();
+	SLVM_state state(memory_size);
+	state.output = capture;
+	state.output_context = &outcome.output;
+	state.quicken = mode.quicken;
+	if (!state.running || !state.load(store)) {
+		outcome.output += "<does not load>";
+		return outcome;
+	}
+#ifdef SLVM_JIT
+	if (mode.jit) {
+		Jit jit;
+		jit.init(&state);
+		jit.run();
+	} else
+#endif
+		state.run();
+	outcome.finished = state.finished;
+	return outcome;
+}
+
+int main(int argc, char * argv[]) {
+	uint64_t first = 0, last = 200;
+	bool verbose = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--seeds" && i + 2 < argc) {
+			first = strtoull(argv[++i], NULL, 10);
+			last = strtoull(argv[++i], NULL, 10);
+		} else if (arg == "--verbose")
+			verbose = true;
+		else {
+			printf("usage: %s [--seeds FIRST LAST] [--verbose]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	std::vector<bool> layouts = {false};
+#ifdef SLVM_JIT
+	layouts.push_back(true);
+#endif
+	size_t runs = 0, failures = 0;
+	for (uint64_t seed = first; seed < last; seed++) {
+		for (bool far : layouts) {
+			std::string text = generate(seed, far);
+			addr_t memory_size = far ? FAR_MEMORY : DEFAULT_MEMORY_SIZE;
+			Outcome expected = run(text, MODES[0], memory_size);
+			for (const Mode & mode : MODES) {
+				if (&mode == &MODES[0])
+					continue;
+				Outcome got = run(text, mode, memory_size);
+				runs++;
+				if (got.output == expected.output && got.finished == expected.finished)
+					continue;
+				failures++;
+				printf("seed %llu%s: %s differs from %s\n", (unsigned long long)seed, far ? " (far)" : "", mode.name, MODES[0].name);
+				if (verbose)
+					printf("--- program\n%s--- %s\n%s--- %s\n%s", text.c_str(), MODES[0].name, expected.output.c_str(), mode.name, got.output.c_str());
+			}
+		}
+	}
+	printf("%zu runs, %zu failures\n", runs, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+// prints a trace written by `CSLVM --trace` as text, one instruction per line:
+//     <instruction index> <source line> <instruction> <accumulator>
+// the source line is only known if the program is passed too.
+//
+// usage: trace-decode <trace file> [program]
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "../src/pre-parser.cpp"
+#include "../src/trace.cpp"
+
+int main(int argc, char * argv[]) {
+	if (argc < 2) {
+		printf("usage: %s <trace file> [program]\n", argv[0]);
+		return 1;
+	}
+	FILE * in = fopen(argv[1], "rb");
+	if (!in) {
+		printf("Could not open file: %s\n", argv[1]);
+		return 1;
+	}
+	TraceHeader header;
+	if (
+		fread(&header, sizeof(header), 1, in) != 1
+		|| strncmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+	) {
+		printf("Not a trace file: %s\n", argv[1]);
+		return 1;
+	}
+	if (header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+		printf("Unsupported trace version %u\n", header.version);
+		return 1;
+	}
+
+	// decoding the program again gives the same instruction indices
+	InstructionStorage store;
+	if (argc > 2) {
+		if (!store.open(argv[2])) {
+			printf("Could not open file: %s\n", argv[2]);
+			return 1;
+		}
+		if (!store.decode())
+			return 1;
+	}
+
+	TraceRecord r;
+	while (fread(&r, sizeof(r), 1, in) == 1) {
+		printf("%u\t", r.ip);
+		if (r.ip < store.code_size)
+			printf("%d\t", store.code[r.ip].line + 1);
+		else
+			printf("?\t");
+		printf("%s\t", instruction_name((Instruction)r.op).c_str());
+		switch (r.kind) {
+			case TV_UNINIT: printf("-\n"); break;
+			case TV_NUM:    printf("%g\n", r.accumulator); break;
+			default:        printf("<string>\n"); break;
+		}
+	}
+	fclose(in);
+	return 0;
+}